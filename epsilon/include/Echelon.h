@@ -26,14 +26,18 @@
 #include <FermatArray.h>
 #include <vector>
 #include <map>
+#include <string>
 #include <iterator>
 
+class Session;
+
 class EchelonBase {
     public:
         class Row {
             protected:
                 Fermat *fermat;
                 std::vector<std::pair<int,FermatExpression>> data;
+                int _pivot;
             public:
                 Row(Fermat *fermat);
 
@@ -41,18 +45,32 @@ class EchelonBase {
                 Row operator*(const FermatExpression &f) const;
                 FermatExpression operator[] (int c) const;
 
+                bool has(int c) const;
                 bool empty() const;
                 size_t size() const;
                 int col1() const;
                 int maxcol() const;
+                int pivot() const;      // col1() unless the solver pivoted elsewhere
+                void setPivot(int c);
 
                 void set(int n, const FermatExpression &ex);
                 void clear();
 
                 void normalize();
+                void normalize(int c);
+
+                // transport between fermat sessions, one call per row on export
+                void exportData(std::vector<int> &cols, std::vector<std::string> &vals) const;
+                void importData(const std::vector<int> &cols, const std::vector<std::string> &vals);
+
+                // fused in place updates, both rows must be normalized
+                void eliminate(const Row &pivot);   // *this - pivot, same leading column
+                void reduce(const Row &pivot);      // *this - (*this)[pivot.pivot()]*pivot
 
                 std::vector<std::pair<int,FermatExpression>>::const_iterator begin() const;
                 std::vector<std::pair<int,FermatExpression>>::const_iterator end() const;
+            private:
+                void axpy(const std::string &factor, const Row &x, int cancel);
         };
 
         class Iterator : public std::iterator<std::input_iterator_tag,int> {
@@ -64,12 +82,13 @@ class EchelonBase {
 
                 //EchelonFermat
                 FermatArray *array;
+                std::map<int,Row> *fetched;
                 int rownum;
                 bool valid;
                 Row row;
             public:
                 Iterator(Fermat *fermat, std::map<int,std::vector<Row>> *rows, const std::map<int,std::vector<Row>>::iterator &it1, const std::vector<Row>::iterator &it2);
-                Iterator(FermatArray *array, int r);
+                Iterator(FermatArray *array, std::map<int,Row> *fetched, int r);
                 Iterator(const Iterator &it);
                 Iterator &operator++();
                 Iterator operator++(int);
@@ -78,6 +97,8 @@ class EchelonBase {
                 Row &operator*();
         };
 
+        virtual ~EchelonBase() {}
+
         virtual void set(const Row &row) = 0;
         virtual void set(const std::map<int,FermatExpression> &m) = 0;
         virtual int run() = 0; 
@@ -92,8 +113,21 @@ class Echelon : public EchelonBase {
     protected:
         Fermat *fermat;
         std::map<int,std::vector<Row>> rows;
+        Session *session;
+        int threads;
+
+        // out of core mode: buckets beyond the active column are written to spilldir
+        size_t spillLimit;
+        std::string spilldir;
+        std::map<int,size_t> spilled;
+        size_t inmemory;
+        int activeCol;
     public:
         Echelon(Fermat *fermat);
+        virtual ~Echelon();
+
+        void setWorkers(Session *session, int threads);
+        void setSpill(size_t limit);    // keep at most limit rows in memory, 0 disables spilling
 
         virtual void set(const Row &row);
         virtual void set(const std::map<int,FermatExpression> &m);
@@ -106,6 +140,61 @@ class Echelon : public EchelonBase {
     private:
         int findPivot(const std::vector<Row> &rows) const;
         void normalize(std::vector<Row> &rows);
+        void backSubstitution();
+        void backSubstitutionParallel();
+    protected:
+        void store(Row &&row);
+        void spill();
+        void unspill(int col);
+        std::string spillfile(int col) const;
+};
+
+// chooses pivot rows and columns jointly by the Markowitz criterion. the rows are returned keyed by their
+// pivot columns, i.e. in row reduced echelon form up to a column permutation. columns beyond unknowns are
+// never pivots (right hand sides).
+class EchelonMarkowitz : public Echelon {
+    protected:
+        int unknowns;
+    public:
+        EchelonMarkowitz(Fermat *fermat, int unknowns);
+
+        virtual int run();
+};
+
+// collects the rows and hands them to Echelon or EchelonFermat, whichever is predicted to be faster for the
+// dimensions, density and number of parameters of the system. the cost model is calibrated once per process
+// by solving a small built-in system with both backends.
+class EchelonAuto : public EchelonBase {
+    protected:
+        Fermat *fermat;
+        std::vector<Row> rows;
+        EchelonBase *backend;
+        Session *session;
+        int threads;
+        size_t spillLimit;
+        int unknowns;           // >= 0: the sparse backend is EchelonMarkowitz with this many unknowns
+
+        static bool calibrated;
+        static double costSparse;
+        static double costFermat;
+    public:
+        EchelonAuto(Fermat *fermat);
+        virtual ~EchelonAuto();
+
+        void setWorkers(Session *session, int threads);
+        void setSpill(size_t limit);
+        void setMarkowitz(int unknowns);
+
+        virtual void set(const Row &row);
+        virtual void set(const std::map<int,FermatExpression> &m);
+        virtual int run();
+
+        virtual Iterator begin();
+        virtual Iterator end();
+
+        virtual void print(std::ostream &os) const;
+    private:
+        static void calibrate(Fermat *fermat);
 };
 
 class EchelonFermat : public EchelonBase {
@@ -113,6 +202,7 @@ class EchelonFermat : public EchelonBase {
         Fermat *fermat;
         FermatArray array;
         int pos;
+        std::map<int,Row> fetched;  // nonzero rows of the reduced array, empty if the bulk fetch failed
     public:
         EchelonFermat(Fermat *fermat, int rows, int cols);
     
@@ -124,6 +214,8 @@ class EchelonFermat : public EchelonBase {
         virtual Iterator end();
 
         virtual void print(std::ostream &os) const;
+    private:
+        void fetch();
 };
     	
 std::ostream &operator<<(std::ostream &os, const EchelonBase &e);
@@ -23,6 +23,7 @@
 #define __EIGENVALUES_H
 
 #include <map>
+#include <vector>
 #include <FermatArray.h>
 
 typedef struct _eigen {
@@ -38,6 +39,9 @@ typedef std::map<eigen_t,int> eigenvalues_t;
 
 eigenvalues_t findEigenvalues(const FermatArray &array, int max);
 
+// last rows of the diagonal blocks in the finest block lower triangular partition of a square matrix
+std::vector<int> diagonalBlocks(const FermatArray &array);
+
 #endif //__EIGENVALUES_H
 
 
@@ -38,6 +38,9 @@ typedef struct _jordanBlock {
 
 typedef std::multiset<JordanBlock> JordanSystem;
 
+// use fermat's GramSchm to complete bases of generalized eigenspaces (legacy behaviour)
+extern bool jordanGramSchmidt;
+
 void jordanSystem(const FermatArray &A, const eigenvalues_t &evs, JordanSystem &system);
 void Eigenvectors(const FermatArray &A, eigen_t ev, std::vector<FermatArray> &vectors);
 
@@ -0,0 +1,120 @@
+// vim: set expandtab shiftwidth=4 tabstop=4:
+
+/*
+ *  include/Modular.h
+ *
+ *  Copyright (C) 2017 Mario Prausa
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __MODULAR_H
+#define __MODULAR_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <cstdint>
+#include <FermatArray.h>
+
+// word size primes below 2^31, products of two residues fit into 64 bits.
+extern const uint64_t modPrimes[];
+extern const int modPrimesCount;
+
+class ModDivByZero : public std::runtime_error {
+    public:
+        ModDivByZero();
+};
+
+typedef std::map<std::string,uint64_t> modvalues_t;
+typedef std::vector<std::pair<int,uint64_t>> modrow_t;
+
+uint64_t modInverse(uint64_t a, uint64_t p);
+uint64_t modPow(uint64_t b, uint64_t e, uint64_t p);
+
+// a fermat expression (as returned by FermatExpression::str()) which can be evaluated modulo a prime
+class ModExpression {
+    protected:
+        typedef struct {
+            enum {Num, Sym, Add, Sub, Mul, Div, Neg, Pow} op;
+            std::string str;
+            long exp;
+        } node_t;
+
+        std::vector<node_t> program;    // postfix
+    public:
+        ModExpression();
+        ModExpression(const std::string &str);
+
+        uint64_t eval(const modvalues_t &values, uint64_t p) const;
+        void symbols(std::set<std::string> &syms) const;
+    private:
+        void parseExpr(const std::string &s, size_t &pos);
+        void parseTerm(const std::string &s, size_t &pos);
+        void parseUnary(const std::string &s, size_t &pos);
+        void parsePower(const std::string &s, size_t &pos);
+        void parsePrimary(const std::string &s, size_t &pos);
+};
+
+// a FermatArray whose entries can be evaluated modulo a prime. The array is fetched with a single str() call.
+class ModArray {
+    protected:
+        int _rows;
+        int _cols;
+        std::vector<ModExpression> data;
+    public:
+        ModArray();
+        ModArray(const FermatArray &array);
+
+        int rows() const;
+        int cols() const;
+
+        const ModExpression &operator()(int r, int c) const;
+        void symbols(std::set<std::string> &syms) const;
+
+        std::vector<std::vector<uint64_t>> eval(const modvalues_t &values, uint64_t p) const;
+};
+
+// random values for all symbols, every sample uses its own seed
+modvalues_t modRandomValues(const std::set<std::string> &syms, uint64_t p, unsigned seed);
+
+// indices of a maximal set of linearly independent rows, greedily from the top
+std::vector<int> modIndependentRows(const std::vector<modrow_t> &rows, int cols, uint64_t p);
+
+// determinant of a square matrix
+uint64_t modDet(std::vector<std::vector<uint64_t>> m, uint64_t p);
+
+// polynomials are stored as coefficient vectors, lowest power first
+std::vector<uint64_t> modInterpolate(const std::vector<uint64_t> &x, const std::vector<uint64_t> &y, uint64_t p);
+uint64_t modPolyEval(const std::vector<uint64_t> &c, uint64_t x, uint64_t p);
+std::vector<uint64_t> modPolyDivide(const std::vector<uint64_t> &c, uint64_t r, uint64_t p);   // quotient by (t-r)
+
+// reduced row echelon form in place, returns the pivot columns
+std::vector<int> modRowEchelon(std::vector<std::vector<uint64_t>> &m, uint64_t p);
+
+// rational function num/den through the points (x,y) with deg num + deg den < x.size(), den is monic
+bool modRatInterpolate(const std::vector<uint64_t> &x, const std::vector<uint64_t> &y, uint64_t p, std::vector<uint64_t> &num, std::vector<uint64_t> &den);
+
+// chinese remaindering and rational number reconstruction for moduli below 2^124 (four word size primes)
+typedef unsigned __int128 modbig_t;
+typedef __int128 modsbig_t;
+
+modbig_t modCRT(modbig_t u, modbig_t m, uint64_t v, uint64_t p);
+bool modRatReconstruct(modbig_t u, modbig_t m, modsbig_t &a, modsbig_t &b);
+uint64_t modReduce(modsbig_t a, uint64_t p);
+std::string modBigStr(modsbig_t a);
+
+#endif //__MODULAR_H
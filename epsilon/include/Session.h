@@ -0,0 +1,92 @@
+// vim: set expandtab shiftwidth=4 tabstop=4:
+
+/*
+ *  include/Session.h
+ * 
+ *  Copyright (C) 2017 Mario Prausa 
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SESSION_H
+#define __SESSION_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <functional>
+#include <Fermat.h>
+
+class WorkerPool;
+
+// creates fermat sessions. every command which defines the state of a session (symbols,
+// sourced functions, --fermat files) is recorded and replayed on sessions created later.
+// if a polymod is active, its symbol is adjoined first and the polymod is set before anything else.
+class Session {
+    protected:
+        typedef struct {
+            enum {Symbol, Command, Functions} type;
+            std::string str;
+        } entry_t;
+
+        std::string path;
+        bool verbose;
+        std::vector<entry_t> entries;
+        std::map<std::string,std::string> _polymods;
+        std::string active;
+        int _generation;
+        WorkerPool *pool;
+    public:
+        Session(const std::string &path, bool verbose);
+        ~Session();
+
+        Fermat *create() const;
+
+        void addSymbol(Fermat *fermat, const std::string &symbol);
+        void dropSymbol(Fermat *fermat, const std::string &symbol);
+        void execute(Fermat *fermat, const std::string &command);
+        void sourceFunctions(Fermat *fermat);
+
+        void addPolymod(const std::string &symbol, const std::string &poly);
+        std::set<std::string> polymods() const;
+        void setPolymod(const std::string &symbol);
+        std::string polymod() const;
+
+        int generation() const;     // changes whenever sessions created later would differ
+        WorkerPool &workers();
+    private:
+        static void source(Fermat *fermat);
+};
+
+// worker sessions for independent computations. they are kept between calls and recreated after the state
+// of the session changed.
+class WorkerPool {
+    protected:
+        const Session *session;
+        std::vector<Fermat*> workers;
+        std::vector<char> broken;
+        int generation;
+    public:
+        WorkerPool(const Session *session);
+        ~WorkerPool();
+
+        // runs job(worker,i,t) for all i<n on at most threads workers, t is the index of the worker. a worker whose
+        // job throws takes no further jobs and is recreated on the next call. returns false if a job failed.
+        bool run(int threads, size_t n, const std::function<void(Fermat*,size_t,size_t)> &job);
+    private:
+        void clear();
+};
+
+#endif //__SESSION_H
@@ -0,0 +1,51 @@
+// vim: set expandtab shiftwidth=4 tabstop=4:
+
+/*
+ *  include/SizeMonitor.h
+ * 
+ *  Copyright (C) 2017 Mario Prausa 
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SIZE_MONITOR_H
+#define __SIZE_MONITOR_H
+
+#include <string>
+#include <fstream>
+#include <vector>
+#include <ctime>
+#include <FermatArray.h>
+
+class SizeMonitor {
+    public:
+        typedef struct {
+            long nonzero;
+            long terms;
+            long epdeg;         // maximal degree in ep of numerators plus denominators
+        } sizes_t;
+    protected:
+        std::ofstream file;
+        int step;
+        struct timespec start;
+    public:
+        SizeMonitor(std::string filename);
+        ~SizeMonitor();
+
+        static sizes_t measure(const std::vector<FermatArray> &arrays);
+
+        void record(const std::string &label, const std::vector<FermatArray> &arrays);
+};
+
+#endif //__SIZE_MONITOR_H
@@ -0,0 +1,56 @@
+// vim: set expandtab shiftwidth=4 tabstop=4:
+
+/*
+ *  include/Sylvester.h
+ * 
+ *  Copyright (C) 2017 Mario Prausa 
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SYLVESTER_H
+#define __SYLVESTER_H
+
+#include <vector>
+#include <FermatArray.h>
+#include <Eigenvalues.h>
+
+// solves C*G - G*A + k*G = R for G, where C and A are residues whose eigenvalues have the form u+v*ep.
+// the jordan decompositions of C and A are computed once and reused for every k and R.
+class Sylvester {
+    protected:
+        typedef struct {
+            int pos;
+            int size;
+            eigen_t ev;
+        } block_t;
+
+        Fermat *fermat;
+
+        FermatArray P,Pinv;     // C = P*Jc*Pinv
+        FermatArray Q,Qinv;     // A = Q*Ja*Qinv
+
+        std::vector<block_t> cblocks;
+        std::vector<block_t> ablocks;
+    public:
+        Sylvester();
+        Sylvester(const FermatArray &C, const FermatArray &A);
+
+        FermatArray solve(int k, const FermatArray &R) const;
+    private:
+        static void decompose(const FermatArray &M, FermatArray &P, std::vector<block_t> &blocks);
+        void solveResonant(const block_t &a, const block_t &b, const FermatArray &R, FermatArray &H) const;
+};
+
+#endif //__SYLVESTER_H
@@ -26,13 +26,29 @@
 #include <map>
 #include <set>
 #include <list>
+#include <vector>
 #include <climits>
 #include <JordanSystem.h>
 #include <FermatArray.h>
 #include <TransformationQueue.h>
+#include <SizeMonitor.h>
+#include <Sylvester.h>
+#include <Session.h>
 
 extern FermatExpression infinity;
 
+typedef struct {
+    bool echfer;
+    bool echauto;
+    bool markowitz;
+    bool modular;
+    int spill;
+    int simplify;
+    int threads;
+} SystemOptions;
+
+class EchelonBase;
+
 class System {
     protected:
         typedef struct _sing {
@@ -56,6 +72,16 @@ class System {
             int rankC;
         } poincareRank;
 
+        // gauge of the top rank of B at a singularity, computed in a worker session
+        typedef struct {
+            int k;
+            FermatArray B;
+            std::string G;
+        } leftsolution_t;
+
+        // A(xj,0).C at ep and at mu for every finite singularity
+        typedef std::map<FermatExpression,std::pair<FermatArray,FermatArray>> residues_t;
+
         Fermat *fermat;
         TriangleBlockMatrix nullMatrix;
 
@@ -72,12 +98,16 @@ class System {
 
         std::map<FermatExpression,eigenvalues_t> eigenvalues;
         std::map<FermatExpression,JordanSystem> jordans;
+        std::map<FermatExpression,Sylvester> sylvesters;
 
         TransformationQueue tqueue;
-        bool echfer;
+        SizeMonitor *sizemon;
+        Session *session;
+        SystemOptions options;
+        int ntrans;
     public:
-        System(Fermat *fermat, bool echfer);
-        System(Fermat *fermat, std::string filename, int start, int end, bool echfer); 
+        System(Fermat *fermat, const SystemOptions &options);
+        System(Fermat *fermat, std::string filename, int start, int end, const SystemOptions &options); 
         System(const System &orig, int start, int end);
         System(const System &orig, const FermatArray &left, const FermatArray &right);
         System(const System &orig, int ep);
@@ -87,6 +117,9 @@ class System {
 
         void write(std::string filename) const;
         TransformationQueue *transformationQueue();
+        void setMonitor(SizeMonitor *sizemon);
+        void setSession(Session *session);
+        std::string fingerprint() const;
 
         void fuchsify();
         void normalize();
@@ -95,18 +128,31 @@ class System {
         void leftranks();
         int leftreduce(const FermatExpression &xj);
         void leftfuchsify();
+        void simplify();
 
         void balance(const FermatArray &P, const FermatExpression &x1, const FermatExpression &x2);
         void transform(const FermatArray &T); 
         void lefttransformFull(const FermatArray &G, const FermatExpression &x1, int k);
 
         std::map<FermatExpression,FermatArray> exportFuchs() const;
+        std::map<std::string,int> countSymbols(const std::set<std::string> &symbols) const;
     private:
         bool projectorQ(const FermatExpression &x1, const FermatExpression &x2, FermatArray &Q);
         void projectorP(const FermatExpression &x1, FermatArray &P);
 
+        int leftreduce(const FermatExpression &xj, const leftsolution_t *prepared);
+        void leftprepare(std::map<FermatExpression,leftsolution_t> &prepared);
+        FermatArray leftreduceSolve(const FermatArray &B, const TriangleBlockMatrix &A0, int k);
+        EchelonBase *newEchelon(int rows, int cols, int unknowns) const;
         int reduceL0(FermatArray L0, int k, const FermatExpression &x1, std::set<int> &S, FermatArray &Delta);
         bool invariantSubspace(const FermatExpression &x2, const FermatArray &Uk, FermatArray &Vk);
+        FermatArray factorepSolve(const residues_t &residues, const FermatExpression &mu);
+        bool factorepStructured(const residues_t &residues, const FermatExpression &mu, std::vector<FermatArray> &basis, bool &singular);
+        bool factorepSample(const residues_t &residues, const FermatExpression &mu, std::vector<int> &selected);
+        bool factorepModular(const residues_t &residues, const FermatExpression &mu, const std::vector<int> &selected, std::vector<FermatArray> &basis, FermatExpression &mu1);
+        std::vector<FermatArray> factorepSolution(EchelonBase *echelon);
+        FermatArray factorepChoose(const std::vector<FermatArray> &basis, const FermatExpression &mu, int &mu0);
+
         bool findBalance(FermatExpression &x1, FermatExpression &x2, FermatArray &P, const FermatExpression &x0);
         FermatExpression regularPoint();
 
@@ -120,6 +166,8 @@ class System {
         void lefttransformFull_inf(const FermatArray &G, int k);
 
         void updatePoincareRanks();
+        void monitor(const std::string &label);
+        void transformed();
         void jordan(const FermatExpression &xj);
         void eigen(const FermatExpression &xj);
         void inverseJordan(const FermatExpression &xj, std::list<JordanBlock> &inv);
@@ -25,28 +25,69 @@
 #include <string>
 #include <fstream>
 #include <list>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
 #include <FermatArray.h>
 
 class System;
+class Session;
+
+// keep the product of all queued transformations up to date (requires the symbol x).
+extern bool queueProduct;
+
+// set by the signal handlers, served by the writer threads: SIGUSR1 flushes, SIGINT/SIGTERM flush and terminate.
+extern volatile sig_atomic_t queueSignal;
 
 class TransformationQueue {
     protected:
         std::ofstream file;
         std::string _filename;
+
+        // the queue file is written by a background thread. pending lines are bounded by maxPending bytes.
+        std::thread writer;
+        std::mutex mtx;
+        std::condition_variable cv;
+        std::deque<std::string> pending;
+        size_t pendingBytes;
+        bool flushing;
+        bool stopping;
+
+        // binary journal: records are indexed by their offsets in <journal>.idx
+        bool binary;
+        std::ofstream index;
+        std::streamoff journalPos;
+        System *owner;
+
         int before;
         int after;
         Fermat *fermat;
         bool replaying;
+        Session *session;
+        int threads;
 
         typedef struct {
             enum {Balance, Transformation, LeftTrans} type;
             FermatExpression x1;
             FermatExpression x2;
             int k;
-            FermatArray T;
+            int before;     // T only holds the active block, padded by before/after rows and columns
+            int after;
+            uint32_t state;             // checksum of the system after this entry, 0 if unknown (journals only)
+            std::string source;         // journal of a lazily loaded entry
+            std::streamoff offset;
+            mutable bool parsed;
+            mutable FermatArray T;
         } transformation_t;
 
         std::list<transformation_t> queue;
+
+        FermatArray product;
+        size_t productCount;   // number of queue entries multiplied into product
     public:
         TransformationQueue(const TransformationQueue &other);
         TransformationQueue(Fermat *fermat);
@@ -54,9 +95,17 @@ class TransformationQueue {
 
         void setpadding(int before, int after);
         void setfile(std::string _filename, bool append=false);
+        void setjournal(std::string _filename);
+        void setWorkers(Session *session, int threads);
+        void setSystem(System *system);
+        void flush();
+        static void installSignalHandlers();
         std::string filename();
+        bool isReplaying() const;
         void load(std::string _filename);
+        void save(std::string _filename) const;
 
+        int compact(size_t first=0);
         void replay(System &system);
         void exporttrans(std::string filename);
 
@@ -65,6 +114,26 @@ class TransformationQueue {
         void lefttransform(const FermatArray &G, const FermatExpression &x1, int k);
     private:
         std::string pstr(const FermatExpression &x) const;
+        std::string label(const transformation_t &trans) const;
+        void parseLabel(std::string str0, transformation_t &trans) const;
+        void write(std::ostream &out, const transformation_t &trans) const;
+        std::string journalRecord(const transformation_t &trans) const;
+        void loadJournal(std::string _filename);
+        void fetch(const transformation_t &trans) const;
+        uint32_t state(const System &system) const;
+        void startWriter();
+        void stopWriter();
+        void writerLoop();
+        void enqueue(std::string line);
+        void record(transformation_t &trans);
+        FermatArray expand(const transformation_t &trans) const;
+        bool merge(transformation_t &a, const transformation_t &b) const;
+        FermatArray xmatrix(const transformation_t &trans) const;
+        void accumulate();
+        std::string productTree(std::vector<FermatArray> &factors) const;
+        bool productTreeParallel(std::vector<std::string> factors, std::string &T) const;
+        void loadProduct(std::string _filename);
+        void saveProduct(std::string _filename) const;
 };
 
 #endif //__TRANSFORMATION_QUEUE_H
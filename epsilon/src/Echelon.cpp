@@ -20,14 +20,39 @@
  */
 
 #include <Echelon.h>
+#include <Modular.h>
+#include <Session.h>
 #include <climits>
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <set>
+#include <algorithm>
+#include <ctime>
+#include <cmath>
+#include <cstdlib>
+#include <unistd.h>
 using namespace std;
 
+// below this rank the back substitution is not worth the transport to worker sessions
+static const int parallelRows = 32;
+
+static void progress(int &prog, int newprog) {
+    if (newprog >= prog) return;
+
+    for (; prog>newprog; --prog) {
+        if ((prog % 5) == 0) {
+            cout << prog/5;
+        } else {
+            cout << ".";
+        }
+    }
+    cout << flush;
+}
+
 EchelonBase::Row::Row(Fermat *fermat) {
     this->fermat = fermat;
+    _pivot = -1;
 }
 
 EchelonBase::Row EchelonBase::Row::operator-(const EchelonBase::Row &other) const {
@@ -93,6 +118,11 @@ FermatExpression EchelonBase::Row::operator[] (int c) const {
     return FermatExpression(fermat,"0");
 }
  
+bool EchelonBase::Row::has(int c) const {
+    auto it = lower_bound(data.begin(),data.end(),c,[](const pair<int,FermatExpression> &e, int c) { return e.first < c; });
+    return it != data.end() && it->first == c;
+}
+
 bool EchelonBase::Row::empty() const {
     return data.empty();
 }
@@ -109,6 +139,22 @@ int EchelonBase::Row::col1() const {
     return data.front().first;
 }
 
+int EchelonBase::Row::maxcol() const {
+    if (empty()) {
+        throw invalid_argument("row is empty.");
+    }
+
+    return data.back().first;
+}
+
+int EchelonBase::Row::pivot() const {
+    return _pivot > 0 ? _pivot : col1();
+}
+
+void EchelonBase::Row::setPivot(int c) {
+    _pivot = c;
+}
+
 void EchelonBase::Row::set(int n, const FermatExpression &ex) {
     if (!data.empty() && n <= data.back().first) {
         throw invalid_argument("wrong order.");
@@ -133,6 +179,183 @@ void EchelonBase::Row::normalize() {
     }
 }
 
+void EchelonBase::Row::normalize(int c) {
+    FermatExpression norm;
+
+    for (auto &e : data) {
+        if (e.first == c) {
+            norm = e.second;
+            break;
+        }
+    }
+
+    if (!norm.fer()) {
+        throw invalid_argument("pivot is zero.");
+    }
+
+    for (auto &e : data) {
+        e.second = e.second/norm;
+    }
+}
+
+void EchelonBase::Row::exportData(vector<int> &cols, vector<string> &vals) const {
+    stringstream strm;
+    int depth=0;
+    string elem;
+
+    cols.clear();
+    vals.clear();
+
+    if (empty()) return;
+
+    strm << "{{";
+    for (size_t n=0; n<data.size(); ++n) {
+        strm << (n?",":"") << data[n].second.name();
+        cols.push_back(data[n].first);
+    }
+    strm << "}}";
+
+    string s = FermatArray(fermat,strm.str()).str();
+
+    // {{a,b,...}}
+    for (auto &c : s) {
+        if (isspace(c)) continue;
+
+        switch (c) {
+            case '{':
+            case '[':
+                if (++depth > 2) elem += c;
+                break;
+            case '}':
+            case ']':
+                if (depth-- == 2) {
+                    vals.push_back(elem);
+                } else if (depth >= 2) {
+                    elem += c;
+                }
+                break;
+            case '(':
+                ++depth;
+                elem += c;
+                break;
+            case ')':
+                --depth;
+                elem += c;
+                break;
+            case ',':
+                if (depth == 2) {
+                    vals.push_back(elem);
+                    elem = "";
+                } else {
+                    elem += c;
+                }
+                break;
+            default:
+                elem += c;
+        }
+    }
+
+    if (vals.size() != cols.size()) {
+        throw runtime_error("unable to export row.");
+    }
+}
+
+void EchelonBase::Row::importData(const vector<int> &cols, const vector<string> &vals) {
+    data.clear();
+
+    for (size_t n=0; n<cols.size(); ++n) {
+        data.push_back({cols[n],FermatExpression(fermat,vals[n])});
+    }
+}
+
+void EchelonBase::Row::eliminate(const Row &pivot) {
+    axpy("(-1)",pivot,pivot.col1());
+}
+
+void EchelonBase::Row::reduce(const Row &pivot) {
+    int c = pivot.pivot();
+
+    for (auto &e : data) {
+        if (e.first < c) continue;
+        if (e.first > c) break;
+
+        axpy("(-("+e.second.name()+"))",pivot,c);
+        break;
+    }
+}
+
+/*
+ *  *this + factor*x, where factor is a nonzero fermat expression. Every entry costs a single fermat statement,
+ *  only entries present in both rows can vanish. Their zero tests are batched into one array if there are more
+ *  than a few of them. The entry at column cancel is known to vanish and is dropped without computing it.
+ */
+void EchelonBase::Row::axpy(const string &factor, const Row &x, int cancel) {
+    static thread_local vector<pair<int,FermatExpression>> merged;
+    vector<size_t> fused;
+    vector<bool> zero;
+    auto it1 = data.begin();
+    auto it2 = x.data.begin();
+
+    merged.clear();
+    merged.reserve(data.size()+x.data.size());
+
+    while (it1 != data.end() || it2 != x.data.end()) {
+        if (it2 == x.data.end() || (it1 != data.end() && it1->first < it2->first)) {
+            merged.push_back(*it1);
+            ++it1;
+        } else if (it1 == data.end() || it2->first < it1->first) {
+            merged.push_back({it2->first,FermatExpression(fermat,factor+"*("+it2->second.name()+")")});
+            ++it2;
+        } else {
+            if (it1->first != cancel) {
+                fused.push_back(merged.size());
+                merged.push_back({it1->first,FermatExpression(fermat,it1->second.name()+"+"+factor+"*("+it2->second.name()+")")});
+            }
+            ++it1;
+            ++it2;
+        }
+    }
+
+    zero.resize(merged.size(),false);
+
+    if (fused.size() > 3) {
+        stringstream strm;
+
+        strm << "{";
+        for (size_t n=0; n<fused.size(); ++n) {
+            strm << (n?",":"") << "{" << merged[fused[n]].second.name() << "}";
+        }
+        strm << "}";
+
+        FermatArray vals(fermat,strm.str());
+        FermatArray last(fermat,fused.size(),1);
+
+        last.assign("0");
+        (*fermat)("LastNonzero(["+vals.name()+"],["+last.name()+"])");
+
+        vector<vector<uint64_t>> nonzero = ModArray(last).eval(modvalues_t(),modPrimes[0]);
+
+        for (size_t n=0; n<fused.size(); ++n) {
+            zero[fused[n]] = nonzero[n][0] == 0;
+        }
+    } else {
+        for (auto n : fused) {
+            zero[n] = merged[n].second.str() == "0";
+        }
+    }
+
+    size_t cnt=0;
+    for (size_t n=0; n<merged.size(); ++n) {
+        if (zero[n]) continue;
+        if (cnt != n) merged[cnt] = merged[n];
+        ++cnt;
+    }
+    merged.erase(merged.begin()+cnt,merged.end());
+
+    data.swap(merged);
+    merged.clear();
+}
+
 vector<pair<int,FermatExpression>>::const_iterator EchelonBase::Row::begin() const {
     return data.begin();
 }
@@ -146,11 +369,13 @@ EchelonBase::Iterator::Iterator(Fermat *fermat, std::map<int,std::vector<Row>> *
 	this->it1 = it1;
 	this->it2 = it2;
     this->array = NULL;
+    this->fetched = NULL;
 }
 
-EchelonBase::Iterator::Iterator(FermatArray *array, int r) : row(array->fer()) {
+EchelonBase::Iterator::Iterator(FermatArray *array, map<int,Row> *fetched, int r) : row(array->fer()) {
     this->rows = NULL;
     this->array = array;
+    this->fetched = fetched;
     rownum = r;
     valid=false;
 }
@@ -161,6 +386,7 @@ EchelonBase::Iterator::Iterator(const Iterator &it) : row(it.row) {
     it2 = it.it2;
 
     array = it.array;
+    fetched = it.fetched;
     rownum = it.rownum;
     valid = false;
 }
@@ -204,9 +430,17 @@ EchelonBase::Row &EchelonBase::Iterator::operator*() {
     if (rows) {
         return *it2;
     } else {
+        if (fetched && !fetched->empty()) {
+            auto it = fetched->find(rownum);
+            if (it != fetched->end()) return it->second;
+
+            row.clear();
+            return row;
+        }
+
         if (!valid) {
             row.clear();
-            for (int c=1; c<=array->cols(); ++c) {  //TODO: this could be optimized with sparse access loops
+            for (int c=1; c<=array->cols(); ++c) {
                 row.set(c,(*array)(rownum,c));
             } 
             valid = true;
@@ -217,11 +451,142 @@ EchelonBase::Row &EchelonBase::Iterator::operator*() {
 
 Echelon::Echelon(Fermat *fermat) {
     this->fermat = fermat;
+    session = NULL;
+    threads = 1;
+    spillLimit = 0;
+    inmemory = 0;
+    activeCol = 0;
+}
+
+Echelon::~Echelon() {
+    for (auto &s : spilled) {
+        unlink(spillfile(s.first).c_str());
+    }
+
+    if (spilldir != "") {
+        rmdir(spilldir.c_str());
+    }
+}
+
+void Echelon::setSpill(size_t limit) {
+    spillLimit = limit;
+}
+
+string Echelon::spillfile(int col) const {
+    return spilldir+"/"+to_string(col);
+}
+
+void Echelon::store(Row &&row) {
+    int c = row.col1();
+
+    rows[c].push_back(move(row));
+    ++inmemory;
+
+    if (spillLimit && inmemory > spillLimit) spill();
+}
+
+/*
+ *  writes the buckets with the highest leading columns to disk until half of the limit is reached. a row is
+ *  one line of col:value pairs separated by semicolons. the bucket keys stay in the map, so that forward
+ *  elimination still visits them.
+ */
+void Echelon::spill() {
+    if (spilldir == "") {
+        spilldir = getenv("TMPDIR")?getenv("TMPDIR"):"/tmp";
+        spilldir += "/epsilonXXXXXX";
+
+        if (!mkdtemp(&spilldir[0])) {
+            spilldir = "";
+            throw runtime_error("unable to create spill directory.");
+        }
+    }
+
+    for (auto it = rows.rbegin(); it != rows.rend() && inmemory > spillLimit/2; ++it) {
+        if (it->first <= activeCol) break;
+        if (it->second.empty()) continue;
+
+        ofstream out(spillfile(it->first),ios::app);
+
+        if (!out.is_open()) {
+            throw runtime_error("unable to open "+spillfile(it->first)+".");
+        }
+
+        for (auto &r : it->second) {
+            vector<int> cols;
+            vector<string> vals;
+
+            r.exportData(cols,vals);
+
+            for (size_t n=0; n<cols.size(); ++n) {
+                out << (n?";":"") << cols[n] << ":" << vals[n];
+            }
+            out << endl;
+        }
+
+        out.close();
+
+        spilled[it->first] += it->second.size();
+        inmemory -= it->second.size();
+
+        it->second.clear();
+        it->second.shrink_to_fit();
+    }
+}
+
+void Echelon::unspill(int col) {
+    if (!spilled.count(col)) return;
+
+    ifstream in(spillfile(col));
+    string line;
+
+    if (!in.is_open()) {
+        throw runtime_error("unable to open "+spillfile(col)+".");
+    }
+
+    while (getline(in,line)) {
+        vector<int> cols;
+        vector<string> vals;
+        size_t start = 0;
+
+        if (line == "") continue;
+
+        while (start <= line.size()) {
+            size_t end = line.find(';',start);
+            if (end == string::npos) end = line.size();
+
+            string entry = line.substr(start,end-start);
+            size_t colon = entry.find(':');
+
+            if (colon == string::npos) {
+                throw runtime_error("corrupt spill file "+spillfile(col)+".");
+            }
+
+            cols.push_back(stoi(entry.substr(0,colon)));
+            vals.push_back(entry.substr(colon+1));
+
+            start = end+1;
+        }
+
+        Row r(fermat);
+        r.importData(cols,vals);
+
+        rows[col].push_back(move(r));
+        ++inmemory;
+    }
+
+    in.close();
+    unlink(spillfile(col).c_str());
+    spilled.erase(col);
+}
+
+void Echelon::setWorkers(Session *session, int threads) {
+    this->session = session;
+    this->threads = threads;
 }
 
 void Echelon::set(const Row &row) {
     if (row.empty()) return;
-    rows[row.col1()].push_back(row);
+    store(Row(row));
 }
         
 void Echelon::set(const std::map<int,FermatExpression> &m) {
@@ -238,6 +603,7 @@ int Echelon::run() {
 
     for (auto &r0 : rows) {
         rnum += r0.second.size();
+        cols.insert(r0.first);
         for (auto &r : r0.second) {
             for (auto &e : r) {
                 cols.insert(e.first);
@@ -245,6 +611,10 @@ int Echelon::run() {
         }
     }
 
+    for (auto &s : spilled) {
+        rnum += s.second;
+    }
+
     int maxrk = min(rnum,cols.size());
     int cnt=0;
     int prog=50;
@@ -252,7 +622,11 @@ int Echelon::run() {
     cout << "forward elimination:  " << flush;
 
     for (auto it = rows.begin(); it != rows.end(); ++it) {
-        int newprog = 50 - (++cnt)*50/maxrk;
+        int newprog = max(0,50 - (++cnt)*50/maxrk);
+
+        activeCol = it->first;
+        unspill(it->first);
+        inmemory -= it->second.size();
 
         if (newprog < prog) {
             for (; prog>newprog; --prog) {
@@ -269,14 +643,19 @@ int Echelon::run() {
         normalize(it->second);
 
         int pivotn = findPivot(it->second);
-        Row pivot = it->second[pivotn];
+        Row pivot = move(it->second[pivotn]);
 
         for (int n=0; n<it->second.size(); ++n) {
             if (n == pivotn) continue;
-            set(it->second[n] - pivot);
+
+            Row &r = it->second[n];
+
+            r.eliminate(pivot);
+            if (!r.empty()) store(move(r));
         }
         it->second.clear();
-        set(pivot);
+        it->second.push_back(move(pivot));
+        ++inmemory;
     }
 
     for (; prog>=0; --prog) {
@@ -289,8 +668,20 @@ int Echelon::run() {
     cout << endl;
 
     int rk = rows.size();
-    cnt = 0;
-    prog=50;
+
+    if (session && threads > 1 && rk >= parallelRows) {
+        backSubstitutionParallel();
+    } else {
+        backSubstitution();
+    }
+
+    return rk;
+}
+
+void Echelon::backSubstitution() {
+    int rk = rows.size();
+    int cnt = 0;
+    int prog=50;
     
     cout << "back substitution:    " << flush;
 
@@ -311,7 +702,7 @@ int Echelon::run() {
 
         for (auto it2 = next(it); it2 != rows.rend(); ++it2) {
             for (auto &r : it2->second) {
-                r = r - it->second.front()*r[it->first];
+                r.reduce(it->second.front());
             }
         }
     }
@@ -324,8 +715,113 @@ int Echelon::run() {
         }
     }
     cout << endl;
+}
 
-    return rk;
+/*
+ *  A fully reduced pivot row only contains its pivot and non pivot columns, so reducing by it never introduces
+ *  other pivot columns. A row therefore depends exactly on the pivot rows of the pivot columns it contains and
+ *  the dependencies are known after forward elimination. Rows are grouped into wavefronts (level = 1 + highest
+ *  level of its dependencies), all rows of a wavefront are reduced concurrently in worker sessions. Workers only
+ *  see strings, every final row is exported once and cached per worker.
+ */
+void Echelon::backSubstitutionParallel() {
+    typedef struct {
+        int pivot;
+        vector<int> deps;
+        vector<int> cols;
+        vector<string> vals;
+    } task_t;
+
+    map<int,int> level;
+    map<int,pair<vector<int>,vector<string>>> finished;
+    vector<vector<task_t>> waves;
+
+    for (auto it = rows.rbegin(); it != rows.rend(); ++it) {
+        task_t task;
+        int l=0;
+
+        task.pivot = it->first;
+
+        for (auto &e : it->second.front()) {
+            if (e.first == it->first || !rows.count(e.first)) continue;
+
+            task.deps.push_back(e.first);
+            l = max(l,level[e.first]+1);
+        }
+
+        level[it->first] = l;
+
+        if (l == 0) continue;
+
+        if (waves.size() < (size_t)l) waves.resize(l);
+        waves[l-1].push_back(task);
+    }
+
+    int rk = rows.size();
+    int cnt = rk;
+    int prog = 50;
+
+    for (auto &w : waves) {
+        cnt -= w.size();
+    }
+
+    cout << "back substitution:    " << flush;
+    progress(prog,50 - cnt*50/rk);
+
+    WorkerPool &pool = session->workers();
+    vector<map<int,Row>> caches(threads);
+
+    for (auto &wave : waves) {
+        for (auto &task : wave) {
+            rows[task.pivot].front().exportData(task.cols,task.vals);
+
+            for (int c : task.deps) {
+                if (!finished.count(c)) {
+                    rows[c].front().exportData(finished[c].first,finished[c].second);
+                }
+            }
+        }
+
+        bool ok = pool.run(threads,wave.size(),[&](Fermat *worker, size_t i, size_t t) {
+            task_t &task = wave[i];
+            Row r(worker);
+
+            r.importData(task.cols,task.vals);
+
+            for (int c : task.deps) {
+                if (!caches[t].count(c)) {
+                    Row d(worker);
+                    d.importData(finished.at(c).first,finished.at(c).second);
+                    caches[t].insert({c,move(d)});
+                }
+
+                r.reduce(caches[t].at(c));
+            }
+
+            r.exportData(task.cols,task.vals);
+        });
+
+        if (!ok) {
+            // finished waves are already imported, the serial pass only reduces the remaining rows
+            caches.clear();
+            cout << endl << "WARNING: back substitution failed in worker session. continuing serially." << endl;
+            backSubstitution();
+            return;
+        }
+
+        for (auto &task : wave) {
+            rows[task.pivot].front().importData(task.cols,task.vals);
+            finished[task.pivot] = {task.cols,task.vals};
+        }
+
+        cnt += wave.size();
+        progress(prog,50 - cnt*50/rk);
+    }
+
+    caches.clear();
+
+    progress(prog,-1);
+    cout << endl;
 }
 
 int Echelon::findPivot(const vector<Row> &rows) const {
@@ -382,6 +878,392 @@ void Echelon::print(ostream &os) const {
     os << "]";
 }
 
+EchelonMarkowitz::EchelonMarkowitz(Fermat *fermat, int unknowns) : Echelon(fermat) {
+    this->unknowns = unknowns;
+}
+
+/*
+ *  Gauss-Jordan elimination. In every step the entry (r,c) of the remaining rows with the smallest
+ *  (entries of r - 1)*(entries in column c - 1) is chosen as pivot. Ties are broken by the size of the
+ *  expressions in r, i.e. the total length of their strings, which is cached per row. Column counts and
+ *  sizes are only updated for rows that contain the pivot column, all other rows are left unchanged.
+ */
+int EchelonMarkowitz::run() {
+    vector<Row> active;
+    vector<size_t> weight;
+    vector<Row> done;
+    map<int,int> colcount;
+
+    while (!spilled.empty()) {
+        unspill(spilled.begin()->first);
+    }
+
+    for (auto &r0 : rows) {
+        for (auto &r : r0.second) {
+            active.push_back(move(r));
+        }
+    }
+    rows.clear();
+
+    auto count = [&](const Row &r, int d) {
+        for (auto &e : r) {
+            if (e.first <= unknowns) colcount[e.first] += d;
+        }
+    };
+
+    auto measure = [](const Row &r) {
+        size_t w = 0;
+        for (auto &e : r) {
+            w += e.second.str().size();
+        }
+        return w;
+    };
+
+    for (auto &r : active) {
+        count(r,1);
+        weight.push_back(measure(r));
+    }
+
+    int total = active.size();
+    int prog = 50;
+
+    cout << "forward elimination:  " << flush;
+
+    while (!active.empty()) {
+        size_t best = SIZE_MAX;
+        size_t bestweight = SIZE_MAX;
+        int bestrow = -1;
+        int bestcol = -1;
+
+        for (size_t n=0; n<active.size(); ++n) {
+            const Row &r = active[n];
+
+            for (auto &e : r) {
+                if (e.first > unknowns) break;
+
+                size_t cost = (r.size()-1)*(colcount[e.first]-1);
+
+                if (cost < best || (cost == best && weight[n] < bestweight)) {
+                    best = cost;
+                    bestweight = weight[n];
+                    bestrow = n;
+                    bestcol = e.first;
+                }
+            }
+        }
+
+        if (bestrow < 0) {
+            // only right hand sides are left, the system is inconsistent
+            for (auto &r : active) {
+                r.setPivot(r.col1());
+                done.push_back(move(r));
+            }
+            active.clear();
+            break;
+        }
+
+        Row pivot = move(active[bestrow]);
+        active.erase(active.begin()+bestrow);
+        weight.erase(weight.begin()+bestrow);
+
+        count(pivot,-1);
+        pivot.normalize(bestcol);
+        pivot.setPivot(bestcol);
+
+        for (size_t n=0; n<active.size();) {
+            Row &r = active[n];
+
+            if (!r.has(bestcol)) {
+                ++n;
+                continue;
+            }
+
+            count(r,-1);
+            r.reduce(pivot);
+
+            if (r.empty()) {
+                active.erase(active.begin()+n);
+                weight.erase(weight.begin()+n);
+            } else {
+                count(r,1);
+                weight[n] = measure(r);
+                ++n;
+            }
+        }
+
+        done.push_back(move(pivot));
+
+        progress(prog,50 - (int)(total-active.size())*50/total);
+    }
+
+    progress(prog,-1);
+    cout << endl;
+
+    int rk = done.size();
+    prog = 50;
+
+    cout << "back substitution:    " << flush;
+
+    for (int n=rk-1; n>=0; --n) {
+        if (done[n].pivot() > unknowns) continue;
+
+        for (int m=0; m<n; ++m) {
+            done[m].reduce(done[n]);
+        }
+
+        progress(prog,50 - (rk-n)*50/rk);
+    }
+
+    progress(prog,-1);
+    cout << endl;
+
+    for (auto &r : done) {
+        int c = r.pivot();
+        rows[c].push_back(move(r));
+    }
+
+    return rk;
+}
+
+bool EchelonAuto::calibrated = false;
+double EchelonAuto::costSparse = 0;
+double EchelonAuto::costFermat = 0;
+
+typedef struct {
+    int rows;
+    int cols;
+    size_t nonzero;
+    int params;
+} echstats_t;
+
+/*
+ *  work estimates: the sparse solver pays a fermat statement for every entry of every row update, roughly
+ *  nonzero * (nonzero/rows). Redrowech works inside fermat, roughly nonzero * min(rows,cols) arithmetic steps,
+ *  which get more expensive with the number of parameters.
+ */
+static double workSparse(const echstats_t &st) {
+    return (double)st.nonzero*st.nonzero/max(st.rows,1);
+}
+
+static double workFermat(const echstats_t &st) {
+    return (double)st.nonzero*min(st.rows,st.cols)*(1+st.params);
+}
+
+static echstats_t echelonStats(const vector<EchelonBase::Row> &rows, bool params) {
+    echstats_t st = {(int)rows.size(),0,0,0};
+    set<string> syms;
+    int sampled = 0;
+
+    for (auto &r : rows) {
+        st.nonzero += r.size();
+        if (!r.empty()) st.cols = max(st.cols,r.maxcol());
+
+        if (!params) continue;
+
+        // sample a few entries for the symbols they contain
+        for (auto &e : r) {
+            if (sampled >= 16) break;
+
+            string str = e.second.str();
+            string id;
+
+            for (size_t n=0; n<=str.size(); ++n) {
+                char c = n<str.size() ? str[n] : ' ';
+
+                if (isalpha(c) || c == '_' || (!id.empty() && isdigit(c))) {
+                    id += c;
+                } else {
+                    if (!id.empty()) syms.insert(id);
+                    id = "";
+                }
+            }
+
+            ++sampled;
+        }
+    }
+
+    st.params = syms.size();
+
+    return st;
+}
+
+static double seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+EchelonAuto::EchelonAuto(Fermat *fermat) {
+    this->fermat = fermat;
+    backend = NULL;
+    session = NULL;
+    threads = 1;
+    spillLimit = 0;
+    unknowns = -1;
+}
+
+EchelonAuto::~EchelonAuto() {
+    if (backend) delete backend;
+}
+
+void EchelonAuto::setWorkers(Session *session, int threads) {
+    this->session = session;
+    this->threads = threads;
+}
+
+// both settings are forwarded to the sparse backend, fermat's Redrowech always works in memory.
+void EchelonAuto::setSpill(size_t limit) {
+    spillLimit = limit;
+}
+
+void EchelonAuto::setMarkowitz(int unknowns) {
+    this->unknowns = unknowns;
+}
+
+void EchelonAuto::set(const Row &row) {
+    if (row.empty()) return;
+    rows.push_back(row);
+}
+
+void EchelonAuto::set(const map<int,FermatExpression> &m) {
+    Row row(fermat);
+    for (auto &e : m) {
+        row.set(e.first,e.second);
+    }
+    set(row);
+}
+
+// solves a small sparse system in ep with both backends, output of the solvers is suppressed.
+void EchelonAuto::calibrate(Fermat *fermat) {
+    const int n = 12;
+    vector<Row> bench;
+
+    for (int i=1; i<=n; ++i) {
+        map<int,FermatExpression> m;
+
+        for (int j=1; j<=n+1; ++j) {
+            if (j != i && (i*7+j*3)%4 != 0) continue;
+
+            stringstream strm;
+            strm << "(" << i+j << "+" << (i*j)%5+1 << "*ep)/(" << j << "-ep)";
+            m[j] = FermatExpression(fermat,strm.str());
+        }
+
+        Row row(fermat);
+        for (auto &e : m) {
+            row.set(e.first,e.second);
+        }
+        bench.push_back(row);
+    }
+
+    echstats_t st = echelonStats(bench,false);
+    st.params = 1;
+
+    stringstream null;
+    streambuf *buf = cout.rdbuf(null.rdbuf());
+
+    try {
+        double t0 = seconds();
+
+        Echelon sparse(fermat);
+        for (auto &r : bench) {
+            sparse.set(r);
+        }
+        sparse.run();
+
+        double t1 = seconds();
+
+        EchelonFermat dense(fermat,st.rows,st.cols);
+        for (auto &r : bench) {
+            dense.set(r);
+        }
+        dense.run();
+
+        double t2 = seconds();
+
+        costSparse = (t1-t0)/workSparse(st);
+        costFermat = (t2-t1)/workFermat(st);
+    } catch (...) {
+        cout.rdbuf(buf);
+        throw;
+    }
+
+    cout.rdbuf(buf);
+    calibrated = true;
+}
+
+int EchelonAuto::run() {
+    if (backend) delete backend;
+    backend = NULL;
+
+    if (!calibrated) calibrate(fermat);
+
+    echstats_t st = echelonStats(rows,true);
+    double ts = costSparse*workSparse(st);
+    double tf = costFermat*workFermat(st);
+
+    streamsize prec = cout.precision(3);
+
+    cout << "echelon: " << st.rows << "x" << st.cols << ", density " << (double)st.nonzero/max(1.0,(double)st.rows*st.cols) << ", " << st.params << " parameters";
+    cout << ", predicted " << ts << "s (sparse) / " << tf << "s (fermat) -> " << (ts <= tf ? "sparse" : "fermat") << endl;
+
+    cout.precision(prec);
+
+    if (ts <= tf) {
+        Echelon *ech;
+
+        if (unknowns >= 0) {
+            ech = new EchelonMarkowitz(fermat,unknowns);
+        } else {
+            ech = new Echelon(fermat);
+            if (session) ech->setWorkers(session,threads);
+        }
+
+        ech->setSpill(spillLimit);
+        backend = ech;
+    } else {
+        if (spillLimit > 0) {
+            cout << "echelon: spill limit does not apply to fermat, the system is kept in memory." << endl;
+        }
+
+        backend = new EchelonFermat(fermat,max(st.rows,1),max(st.cols,1));
+    }
+
+    for (auto &r : rows) {
+        backend->set(r);
+    }
+    rows.clear();
+
+    return backend->run();
+}
+
+EchelonBase::Iterator EchelonAuto::begin() {
+    if (!backend) {
+        throw invalid_argument("echelon has not been run.");
+    }
+    return backend->begin();
+}
+
+EchelonBase::Iterator EchelonAuto::end() {
+    if (!backend) {
+        throw invalid_argument("echelon has not been run.");
+    }
+    return backend->end();
+}
+
+void EchelonAuto::print(ostream &os) const {
+    if (backend) {
+        backend->print(os);
+        return;
+    }
+
+    Echelon tmp(fermat);
+    for (auto &r : rows) {
+        tmp.set(r);
+    }
+    tmp.print(os);
+}
+
 EchelonFermat::EchelonFermat(Fermat *fermat, int rows, int cols) {
     this->fermat = fermat;
 
@@ -408,15 +1290,118 @@ void EchelonFermat::set(const map<int,FermatExpression> &m) {
 int EchelonFermat::run() {
     int rk = array.rowEchelon();
     pos = rk+1;
+
+    fetch();
+
     return rk;
 }
 
+/*
+ *  reads all nonzero entries of the reduced array from a single sstr() call, [[r,[c,expr],...],...].
+ *  If the output cannot be parsed, the iterator falls back to reading entry by entry.
+ */
+void EchelonFermat::fetch() {
+    string s = array.sstr();
+    vector<string> items;
+    string item;
+    int depth = 0;
+    int round = 0;
+
+    fetched.clear();
+
+    auto entries = [](const string &str) {
+        vector<string> parts;
+        string part;
+        int d = 0;
+
+        for (auto &c : str) {
+            if (c == '(' || c == '[') ++d;
+            if (c == ')' || c == ']') --d;
+
+            if (c == ',' && d == 0) {
+                parts.push_back(part);
+                part = "";
+            } else {
+                part += c;
+            }
+        }
+        parts.push_back(part);
+
+        return parts;
+    };
+
+    try {
+        for (auto &c : s) {
+            if (isspace(c)) continue;
+
+            if (c == '(') ++round;
+            if (c == ')') --round;
+
+            if (c == '[' && round == 0) {
+                if (++depth == 2) {
+                    item = "";
+                    continue;
+                }
+            } else if (c == ']' && round == 0) {
+                if (depth-- == 2) {
+                    items.push_back(item);
+                    continue;
+                }
+            }
+
+            if (depth >= 2) item += c;
+        }
+
+        for (auto &it : items) {
+            vector<string> parts = entries(it);
+            int r = stoi(parts[0]);
+            Row row(fermat);
+            vector<int> cols;
+            vector<string> vals;
+
+            for (size_t n=1; n<parts.size(); ++n) {
+                string &e = parts[n];
+
+                if (e.size() < 2 || e.front() != '[' || e.back() != ']') {
+                    throw invalid_argument("unexpected entry.");
+                }
+
+                vector<string> ce = entries(e.substr(1,e.size()-2));
+
+                if (ce.size() != 2) {
+                    throw invalid_argument("unexpected entry.");
+                }
+
+                int c = stoi(ce[0]);
+
+                if (!cols.empty() && c <= cols.back()) {
+                    throw invalid_argument("unexpected entry.");
+                }
+
+                cols.push_back(c);
+                vals.push_back(ce[1]);
+            }
+
+            // the entries of a sparse array are nonzero, no need to test them
+            row.importData(cols,vals);
+
+            if (r < 1 || r >= pos || row.empty()) {
+                throw invalid_argument("unexpected row.");
+            }
+
+            fetched.insert({r,move(row)});
+        }
+    } catch (const exception &e) {
+        fetched.clear();
+    }
+}
+
 EchelonBase::Iterator EchelonFermat::begin() {
-    return Iterator(&array,1);
+    return Iterator(&array,&fetched,1);
 }
 
 EchelonBase::Iterator EchelonFermat::end() {
-    return Iterator(&array,pos);
+    return Iterator(&array,&fetched,pos);
 }
 
 void EchelonFermat::print(ostream &os) const {
@@ -20,6 +20,7 @@
  */
 
 #include <Eigenvalues.h>
+#include <Modular.h>
 #include <sstream>
 #include <iostream>
 using namespace std;
@@ -43,8 +44,102 @@ static bool checkEV(FermatExpression poly, int u, int v) {
     return poly.subst("t",expr).str() == "0";
 }
 
-eigenvalues_t findEigenvalues(const FermatArray &array, int max) {
-	FermatExpression poly = array.chPoly();
+/*
+ *  The characteristic polynomial is fetched once and sampled modulo a prime at n+1 values of t for two
+ *  random values of ep. The candidates u+v*ep are then tested and divided out locally by Horner's rule,
+ *  which yields the multiplicities without any further backend calls. The result is verified symbolically
+ *  by a single division of the characteristic polynomial by the product of its linear factors.
+ */
+static bool findEigenvaluesModular(const FermatExpression &poly, int n, int max, eigenvalues_t &values) {
+    const uint64_t p = modPrimes[0];
+    ModExpression mpoly;
+    set<string> syms;
+    vector<uint64_t> eps;
+    vector<vector<uint64_t>> f;
+    int ctr=0;
+
+    try {
+        mpoly = ModExpression(poly.str());
+    } catch (const invalid_argument &e) {
+        return false;
+    }
+
+    mpoly.symbols(syms);
+    syms.insert("ep");
+    syms.erase("t");
+
+    for (unsigned seed=1; f.size() < 2 && seed <= 8; ++seed) {
+        modvalues_t point = modRandomValues(syms,p,seed);
+        vector<uint64_t> xs,ys;
+
+        if (!eps.empty() && eps[0] == point["ep"]) continue;
+
+        try {
+            for (int t=0; t<=n; ++t) {
+                point["t"] = t;
+                xs.push_back(t);
+                ys.push_back(mpoly.eval(point,p));
+            }
+        } catch (const ModDivByZero &e) {
+            continue;
+        }
+
+        vector<uint64_t> c = modInterpolate(xs,ys,p);
+        if (c[n] == 0) continue;   // degree drops at this point
+
+        eps.push_back(point["ep"]);
+        f.push_back(c);
+    }
+
+    if (f.size() < 2) return false;
+
+    auto check = [&](int u, int v) {
+        for (;;) {
+            uint64_t r[2];
+
+            for (int s=0; s<2; ++s) {
+                r[s] = ((u % (long)p + (long)p) + (v % (long)p + (long)p) * eps[s]) % p;
+                if (modPolyEval(f[s],r[s],p) != 0) return;
+            }
+
+            for (int s=0; s<2; ++s) {
+                f[s] = modPolyDivide(f[s],r[s],p);
+            }
+
+            eigen_t ev;
+            ev.u = u;
+            ev.v = v;
+
+            values[ev]++;
+            ++ctr;
+        }
+    };
+
+    for (int i=0; i<=max && ctr < n; ++i) {
+        for (int j=-i; j<=i && ctr < n; ++j) {
+            check(i,j);
+            if (i == 0) break;
+            check(j,i);
+            check(-i,j);
+            check(j,-i);
+        }
+    }
+
+    if (ctr != n) return false;
+
+    stringstream strm;
+    strm << "1";
+
+    for (auto &ev : values) {
+        strm << "*(t-(" << ev.first.u << "+(" << ev.first.v << ")*ep))^" << ev.second;
+    }
+
+    FermatExpression rest = poly/FermatExpression(poly.fer(),strm.str());
+
+    return rest.numer().deg("t") == 0 && rest.denom().deg("t") == 0;
+}
+
+static eigenvalues_t findEigenvaluesGrid(FermatExpression poly, const FermatArray &array, int max) {
     Fermat *fermat = array.fer();
 	eigenvalues_t values;
     int ctr=0;
@@ -109,3 +204,60 @@ eigenvalues_t findEigenvalues(const FermatArray &array, int max) {
 
     throw runtime_error("unable to find all eigenvalues.\nmatrix was: "+array.str());
 }
+
+static eigenvalues_t findEigenvaluesDense(const FermatArray &array, int max) {
+    FermatExpression poly = array.chPoly();
+    eigenvalues_t values;
+
+    if (findEigenvaluesModular(poly,array.rows(),max,values)) return values;
+
+    return findEigenvaluesGrid(poly,array,max);
+}
+
+eigenvalues_t findEigenvalues(const FermatArray &array, int max) {
+    vector<int> blocks = diagonalBlocks(array);
+    eigenvalues_t values;
+    int r0 = 1;
+
+    if (blocks.size() <= 1) return findEigenvaluesDense(array,max);
+
+    // the characteristic polynomial factorizes into the ones of the diagonal blocks
+    for (int r1 : blocks) {
+        FermatArray D(array,r0,r1,r0,r1);
+
+        for (auto &ev : findEigenvaluesDense(D,max)) {
+            values[ev.first] += ev.second;
+        }
+
+        r0 = r1+1;
+    }
+
+    return values;
+}
+
+vector<int> diagonalBlocks(const FermatArray &array) {
+    int n = array.rows();
+    vector<int> blocks;
+    int reach = 0;
+
+    if (n <= 1) {
+        blocks.push_back(n);
+        return blocks;
+    }
+
+    Fermat *fermat = array.fer();
+    FermatArray last(fermat,n,1);
+
+    last.assign("0");
+    (*fermat)("LastNonzero(["+array.name()+"],["+last.name()+"])");
+
+    vector<vector<uint64_t>> cols = ModArray(last).eval(modvalues_t(),modPrimes[0]);
+
+    // a block ends at row i, if no row up to i reaches beyond column i
+    for (int i=1; i<=n; ++i) {
+        reach = std::max(reach,(int)cols[i-1][0]);
+        if (reach <= i) blocks.push_back(i);
+    }
+
+    return blocks;
+}
@@ -27,15 +27,76 @@
 #include <JordanSystem.h>
 #include <FermatArray.h>
 #include <Eigenvalues.h>
+#include <Modular.h>
 using namespace std;
 
 
+bool jordanGramSchmidt = false;
+
 static void gramSchmidt(FermatArray &U) {
     Fermat *fermat = U.fer();
     (*fermat)("GramSchm(["+U.name()+"])");
 }
 
-static int kern(const FermatArray &mat, FermatArray &U) {
+/*
+ *  zeroes every column which depends on the columns to its left and divides out the content of the others.
+ *  The independent columns are the pivot columns of the fraction free row echelon form. Unlike gramSchmidt()
+ *  the kept columns are the original (sparse) vectors.
+ */
+static void independentColumns(FermatArray &U) {
+    Fermat *fermat = U.fer();
+    set<int> pivots;
+
+    if (jordanGramSchmidt) {
+        gramSchmidt(U);
+        return;
+    }
+
+    if (U.cols() == 0 || U.rows() == 0) return;
+
+    FermatArray E(U);
+    int rk = E.rowEchelon();
+
+    FermatArray first(fermat,E.rows(),1);
+    first.assign("0");
+
+    (*fermat)("FirstNonzero(["+E.name()+"],["+first.name()+"])");
+
+    vector<vector<uint64_t>> piv = ModArray(first).eval(modvalues_t(),modPrimes[0]);
+
+    for (int i=0; i<rk; ++i) {
+        pivots.insert(piv[i][0]);
+    }
+
+    FermatArray select(fermat,U.cols(),U.cols());
+    select.assign("0");
+
+    for (int c : pivots) {
+        select.set(c,c,FermatExpression(fermat,"1"));
+    }
+
+    U = U*select;
+
+    (*fermat)("NormColumns(["+U.name()+"])");
+}
+
+static int kernel(const FermatArray &mat, FermatArray &U) {
+    int rk;
+
+    Fermat *fermat = mat.fer();
+
+    FermatArray M(mat);
+    FermatArray A(fermat,M.rows(),M.rows());
+    FermatArray B(fermat,M.cols(),M.cols());
+
+    rk = M.colReduce(A,B);
+    U = FermatArray(B,1,B.rows(),rk+1,B.cols());
+
+    return M.cols()-rk;
+}
+
+// sparse columns with low degree in ep first
+static void sortColumns(FermatArray &U) {
     struct colprops {
         int col;
         int nonzero;
@@ -47,52 +108,60 @@ static int kern(const FermatArray &mat, FermatArray &U) {
     };
 
     set<colprops> cols;
-    stringstream strm;
-    int rk;
+    Fermat *fermat = U.fer();
 
-    Fermat *fermat = mat.fer();
+    if (U.cols() == 0) return;
 
-    FermatArray M(mat);
-    FermatArray A(fermat,M.rows(),M.rows());
-    FermatArray B(fermat,M.cols(),M.cols());
+    FermatArray stats(fermat,2,U.cols());
+    stats.assign("0");
+
+    (*fermat)("ColStats(["+U.name()+"],["+stats.name()+"])");
+
+    vector<vector<uint64_t>> st = ModArray(stats).eval(modvalues_t(),modPrimes[0]);
 
-    rk = M.colReduce(A,B);
-    U = FermatArray(B,1,B.rows(),rk+1,B.cols());
-    
-    // optimization
     for (int n=1; n<=U.cols(); ++n) {
         colprops cp;
 
         cp.col = n;
-        cp.nonzero = 0;
-        cp.deg = 0;
-
-        for (int j=1; j<=U.rows(); ++j) {
-            if (U(j,n).str() != "0") {
-                cp.nonzero++;
-
-                int ndeg = U(j,n).numer().deg("ep");
-                int ddeg = U(j,n).denom().deg("ep");
-
-                cp.deg = max(cp.deg,ndeg+ddeg);
-            }
-        }
+        cp.nonzero = st[0][n-1];
+        cp.deg = st[1][n-1];
 
         cols.insert(cp);
     }
 
-    FermatArray swap(U.fer(),U.cols(),U.cols());
+    FermatArray swap(fermat,U.cols(),U.cols());
     int c=1;
 
     swap.assign("0");
 
     for (auto it=cols.begin(); it != cols.end(); ++it) {
-        swap.set(it->col,c++,FermatExpression(U.fer(),"1"));
+        swap.set(it->col,c++,FermatExpression(fermat,"1"));
     }
 
     U = U*swap;
+}
 
-    return M.rows()-rk;
+static int kern(const FermatArray &mat, FermatArray &U) {
+    int a = kernel(mat,U);
+
+    sortColumns(U);
+
+    return a;
+}
+
+/*
+ *  kernel of mat^s from the kernel K of mat^(s-1): mat*x = K*y, i.e. the upper part of the kernel of [mat | K].
+ *  This avoids the symbolic powers of mat.
+ */
+static int kernNext(const FermatArray &mat, const FermatArray &K, FermatArray &U) {
+    FermatArray aug = mat.transpose().concatenate(K.transpose()).transpose();
+
+    kernel(aug,U);
+    U = FermatArray(U,1,mat.rows(),1,U.cols());
+
+    sortColumns(U);
+
+    return U.cols();
 }
 
 static void jordanDecomposition(const FermatArray &array, eigen_t ev, JordanSystem &system) {
@@ -113,15 +182,13 @@ static void jordanDecomposition(const FermatArray &array, eigen_t ev, JordanSyst
    
     mat = array - mat;
 
-    FermatArray mat2(mat);
-
     as.push_back(0);
 
     U.assign("0");
     Us.push_back(U);
 
     for (int s=1;; ++s) {
-        int a = kern(mat2,U);
+        int a = (s == 1) ? kern(mat,U) : kernNext(mat,Us[s-1],U);
 
         if (s > 1) {
             int b = 2*(*as.rbegin()) - *(++as.rbegin()) - a;
@@ -133,8 +200,6 @@ static void jordanDecomposition(const FermatArray &array, eigen_t ev, JordanSyst
 
         as.push_back(a);
         Us.push_back(U);
-
-        mat2 = mat2*mat;
     }
     
     for (int s=blocks.size(); s>0; --s) {
@@ -154,7 +219,7 @@ static void jordanDecomposition(const FermatArray &array, eigen_t ev, JordanSyst
 
         B = B.concatenate(Us[s].transpose()).transpose();
 
-        gramSchmidt(B);
+        independentColumns(B);
 
         B = FermatArray(B,1,B.rows(),pos,B.cols());
 
@@ -183,22 +248,98 @@ static void jordanDecomposition(const FermatArray &array, eigen_t ev, JordanSyst
     }
 }
 
+static FermatArray shift(const FermatArray &A, eigen_t ev) {
+    FermatArray mat(A.fer());
+    stringstream strm;
+
+    strm << "[" << A.name() << "] - ((" << ev.u << ")+(" << ev.v << ")*ep)*[1]";
+    mat.assign(strm.str());
+
+    return mat;
+}
+
+/*
+ *  A = [[A11, 0], [A21, A22]] with A11 the leading diagonal block. If ev is no eigenvalue of A11, the chains
+ *  of A22 are padded with zeros. If ev is no eigenvalue of A22, a chain v_k of A11 is lifted to (v_k, x_k) with
+ *  x_k = (A22-ev)^-1 (x_{k-1} - A21 v_k). If ev is an eigenvalue of both, the full matrix is decomposed.
+ */
+static void jordanDecompositionBlocked(const FermatArray &array, const vector<int> &blocks, eigen_t ev, JordanSystem &system) {
+    int n = array.rows();
+    int cut = blocks[0];
+
+    if (blocks.size() <= 1) {
+        jordanDecomposition(array,ev,system);
+        return;
+    }
+
+    Fermat *fermat = array.fer();
+    FermatArray A11(array,1,cut,1,cut);
+    FermatArray A21(array,cut+1,n,1,cut);
+    FermatArray A22(array,cut+1,n,cut+1,n);
+    FermatArray L11 = shift(A11,ev);
+    FermatArray L22 = shift(A22,ev);
+    JordanSystem sub;
+
+    if (L11.rank() == cut) {
+        vector<int> rest;
+        FermatArray zero(fermat,cut,1);
+
+        for (size_t i=1; i<blocks.size(); ++i) {
+            rest.push_back(blocks[i]-cut);
+        }
+
+        zero.assign("0");
+
+        jordanDecompositionBlocked(A22,rest,ev,sub);
+
+        for (auto &blck : sub) {
+            JordanBlock lifted;
+            lifted.ev = ev;
+
+            for (auto &w : blck.rootvectors) {
+                lifted.rootvectors.push_back(zero.concatenate(w));
+            }
+
+            system.insert(lifted);
+        }
+    } else if (L22.rank() == n-cut) {
+        FermatArray L22inv = L22.inverse();
+
+        jordanDecomposition(A11,ev,sub);
+
+        for (auto &blck : sub) {
+            JordanBlock lifted;
+            FermatArray x(fermat,n-cut,1);
+
+            lifted.ev = ev;
+            x.assign("0");
+
+            for (auto &v : blck.rootvectors) {
+                x = L22inv*(x - A21*v);
+                lifted.rootvectors.push_back(v.concatenate(x));
+            }
+
+            system.insert(lifted);
+        }
+    } else {
+        jordanDecomposition(array,ev,system);
+    }
+}
+
 void jordanSystem(const FermatArray &A, const eigenvalues_t &evs, JordanSystem &system) {
+    vector<int> blocks = diagonalBlocks(A);
+
     for (auto &ev : evs) {
-        jordanDecomposition(A,ev.first,system);  
+        jordanDecompositionBlocked(A,blocks,ev.first,system);
     }
 }
 
 void Eigenvectors(const FermatArray &A, eigen_t ev, vector<FermatArray> &vectors) {
-    FermatArray mat(A.fer());
+    FermatArray mat = shift(A,ev);
     FermatArray U;
-    stringstream strm;
-
-    strm << "[" << A.name() << "] - ((" << ev.u << ")+(" << ev.v << ")*ep)*[1]";
-    mat.assign(strm.str());
 
     kern(mat, U);
-    gramSchmidt(U);
+    independentColumns(U);
 
     vectors.clear();
     for (int c=1; c<=U.cols(); ++c) {
@@ -0,0 +1,722 @@
+// vim: set expandtab shiftwidth=4 tabstop=4:
+
+/*
+ *  src/Modular.cpp
+ *
+ *  Copyright (C) 2017 Mario Prausa
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <Modular.h>
+#include <random>
+#include <cctype>
+#include <cmath>
+#include <algorithm>
+using namespace std;
+
+const uint64_t modPrimes[] = {2147483647, 2147483629, 2147483587, 2147483579, 2147483563, 2147483549, 2147483543, 2147483497};
+const int modPrimesCount = sizeof(modPrimes)/sizeof(modPrimes[0]);
+
+ModDivByZero::ModDivByZero() : runtime_error("division by zero modulo prime.") {
+}
+
+uint64_t modPow(uint64_t b, uint64_t e, uint64_t p) {
+    uint64_t res = 1;
+
+    b %= p;
+
+    for (; e; e >>= 1) {
+        if (e & 1) res = res*b % p;
+        b = b*b % p;
+    }
+
+    return res;
+}
+
+uint64_t modInverse(uint64_t a, uint64_t p) {
+    if (a % p == 0) throw ModDivByZero();
+    return modPow(a,p-2,p);
+}
+
+ModExpression::ModExpression() {
+}
+
+ModExpression::ModExpression(const string &str) {
+    string s;
+    size_t pos=0;
+    bool space=false;
+
+    // whitespace between two factors is an implicit multiplication
+    for (auto &c : str) {
+        if (isspace(c)) {
+            space = true;
+            continue;
+        }
+
+        if (space && !s.empty() && (isalnum(s.back()) || s.back() == '_' || s.back() == ')') && (isalnum(c) || c == '_' || c == '(')) {
+            s += '*';
+        }
+
+        s += c;
+        space = false;
+    }
+
+    parseExpr(s,pos);
+
+    if (pos != s.size()) {
+        throw invalid_argument("unable to parse expression: "+str);
+    }
+}
+
+void ModExpression::parseExpr(const string &s, size_t &pos) {
+    parseTerm(s,pos);
+
+    while (pos < s.size() && (s[pos] == '+' || s[pos] == '-')) {
+        char op = s[pos++];
+        node_t node;
+
+        parseTerm(s,pos);
+
+        node.op = (op == '+') ? node_t::Add : node_t::Sub;
+        program.push_back(node);
+    }
+}
+
+void ModExpression::parseTerm(const string &s, size_t &pos) {
+    parseUnary(s,pos);
+
+    while (pos < s.size()) {
+        node_t node;
+
+        if (s[pos] == '*' || s[pos] == '/') {
+            char op = s[pos++];
+
+            parseUnary(s,pos);
+            node.op = (op == '*') ? node_t::Mul : node_t::Div;
+        } else if (isalnum(s[pos]) || s[pos] == '_' || s[pos] == '(') {
+            // implicit multiplication
+            parsePower(s,pos);
+            node.op = node_t::Mul;
+        } else {
+            break;
+        }
+
+        program.push_back(node);
+    }
+}
+
+void ModExpression::parseUnary(const string &s, size_t &pos) {
+    if (pos < s.size() && (s[pos] == '-' || s[pos] == '+')) {
+        char op = s[pos++];
+
+        parseUnary(s,pos);
+
+        if (op == '-') {
+            node_t node;
+            node.op = node_t::Neg;
+            program.push_back(node);
+        }
+        return;
+    }
+
+    parsePower(s,pos);
+}
+
+void ModExpression::parsePower(const string &s, size_t &pos) {
+    parsePrimary(s,pos);
+
+    if (pos < s.size() && s[pos] == '^') {
+        bool paren=false,neg=false;
+        string digits;
+        node_t node;
+
+        ++pos;
+
+        if (pos < s.size() && s[pos] == '(') {
+            paren = true;
+            ++pos;
+        }
+        if (pos < s.size() && (s[pos] == '-' || s[pos] == '+')) {
+            neg = s[pos] == '-';
+            ++pos;
+        }
+        for (; pos < s.size() && isdigit(s[pos]); ++pos) {
+            digits += s[pos];
+        }
+        if (digits.empty()) {
+            throw invalid_argument("unable to parse exponent.");
+        }
+        if (paren) {
+            if (pos >= s.size() || s[pos] != ')') {
+                throw invalid_argument("unable to parse exponent.");
+            }
+            ++pos;
+        }
+
+        node.op = node_t::Pow;
+        node.exp = stol(digits)*(neg?-1:1);
+        program.push_back(node);
+    }
+}
+
+void ModExpression::parsePrimary(const string &s, size_t &pos) {
+    node_t node;
+
+    if (pos >= s.size()) {
+        throw invalid_argument("unexpected end of expression.");
+    }
+
+    if (s[pos] == '(') {
+        ++pos;
+        parseExpr(s,pos);
+
+        if (pos >= s.size() || s[pos] != ')') {
+            throw invalid_argument("unbalanced parentheses.");
+        }
+        ++pos;
+        return;
+    }
+
+    if (isdigit(s[pos])) {
+        node.op = node_t::Num;
+        for (; pos < s.size() && isdigit(s[pos]); ++pos) {
+            node.str += s[pos];
+        }
+    } else if (isalpha(s[pos]) || s[pos] == '_') {
+        node.op = node_t::Sym;
+        for (; pos < s.size() && (isalnum(s[pos]) || s[pos] == '_'); ++pos) {
+            node.str += s[pos];
+        }
+    } else {
+        throw invalid_argument(string("unexpected character '")+s[pos]+"'.");
+    }
+
+    program.push_back(node);
+}
+
+uint64_t ModExpression::eval(const modvalues_t &values, uint64_t p) const {
+    vector<uint64_t> stack;
+    uint64_t a,b;
+
+    for (auto &node : program) {
+        switch (node.op) {
+            case node_t::Num:
+                a = 0;
+                for (auto &c : node.str) {
+                    a = (a*10 + (c-'0')) % p;
+                }
+                stack.push_back(a);
+                break;
+            case node_t::Sym: {
+                auto it = values.find(node.str);
+                if (it == values.end()) {
+                    throw invalid_argument("no value for symbol "+node.str+".");
+                }
+                stack.push_back(it->second % p);
+                break;
+            }
+            case node_t::Neg:
+                stack.back() = (p - stack.back()) % p;
+                break;
+            case node_t::Pow:
+                if (node.exp < 0) {
+                    stack.back() = modPow(modInverse(stack.back(),p),-node.exp,p);
+                } else {
+                    stack.back() = modPow(stack.back(),node.exp,p);
+                }
+                break;
+            default:
+                b = stack.back();
+                stack.pop_back();
+                a = stack.back();
+
+                switch (node.op) {
+                    case node_t::Add:
+                        a = (a+b) % p;
+                        break;
+                    case node_t::Sub:
+                        a = (a+p-b) % p;
+                        break;
+                    case node_t::Mul:
+                        a = a*b % p;
+                        break;
+                    case node_t::Div:
+                        a = a*modInverse(b,p) % p;
+                        break;
+                    default:
+                        break;
+                }
+                stack.back() = a;
+        }
+    }
+
+    if (stack.size() != 1) {
+        throw invalid_argument("malformed expression.");
+    }
+
+    return stack.back();
+}
+
+void ModExpression::symbols(set<string> &syms) const {
+    for (auto &node : program) {
+        if (node.op == node_t::Sym) syms.insert(node.str);
+    }
+}
+
+ModArray::ModArray() {
+    _rows = _cols = 0;
+}
+
+ModArray::ModArray(const FermatArray &array) {
+    string s = array.str();
+    string elem;
+    int depth=0;
+    int r=0;
+
+    _rows = array.rows();
+    _cols = array.cols();
+
+    // {{a,b,...},{c,d,...},...}
+    for (auto &c : s) {
+        if (isspace(c)) continue;
+
+        switch (c) {
+            case '{':
+            case '[':
+                if (++depth == 2) {
+                    elem = "";
+                    ++r;
+                }
+                break;
+            case '}':
+            case ']':
+                if (depth-- == 2) {
+                    data.push_back(ModExpression(elem));
+                }
+                break;
+            case '(':
+                ++depth;
+                elem += c;
+                break;
+            case ')':
+                --depth;
+                elem += c;
+                break;
+            case ',':
+                if (depth == 2) {
+                    data.push_back(ModExpression(elem));
+                    elem = "";
+                } else if (depth > 2) {
+                    elem += c;
+                }
+                break;
+            default:
+                elem += c;
+        }
+    }
+
+    if (r != _rows || data.size() != (size_t)_rows*_cols) {
+        throw invalid_argument("unable to parse array.");
+    }
+}
+
+int ModArray::rows() const {
+    return _rows;
+}
+
+int ModArray::cols() const {
+    return _cols;
+}
+
+const ModExpression &ModArray::operator()(int r, int c) const {
+    return data[(r-1)*_cols + c-1];
+}
+
+void ModArray::symbols(set<string> &syms) const {
+    for (auto &e : data) {
+        e.symbols(syms);
+    }
+}
+
+vector<vector<uint64_t>> ModArray::eval(const modvalues_t &values, uint64_t p) const {
+    vector<vector<uint64_t>> res(_rows,vector<uint64_t>(_cols));
+
+    for (int r=0; r<_rows; ++r) {
+        for (int c=0; c<_cols; ++c) {
+            res[r][c] = data[r*_cols+c].eval(values,p);
+        }
+    }
+
+    return res;
+}
+
+modvalues_t modRandomValues(const set<string> &syms, uint64_t p, unsigned seed) {
+    mt19937_64 gen(seed);
+    uniform_int_distribution<uint64_t> dist(1,p-1);
+    modvalues_t values;
+
+    for (auto &s : syms) {
+        values[s] = dist(gen);
+    }
+
+    return values;
+}
+
+vector<int> modIndependentRows(const vector<modrow_t> &rows, int cols, uint64_t p) {
+    vector<vector<uint64_t>> basis;
+    vector<int> basisOf(cols,-1);
+    vector<int> independent;
+    vector<uint64_t> v(cols);
+
+    for (size_t r=0; r<rows.size() && basis.size() < (size_t)cols; ++r) {
+        fill(v.begin(),v.end(),0);
+
+        for (auto &e : rows[r]) {
+            v[e.first] = (v[e.first] + e.second) % p;
+        }
+
+        for (int c=0; c<cols; ++c) {
+            if (!v[c]) continue;
+
+            if (basisOf[c] >= 0) {
+                // basis rows have their leading entry 1 at c and zeros to the left
+                const vector<uint64_t> &b = basis[basisOf[c]];
+                uint64_t f = v[c];
+
+                for (int j=c; j<cols; ++j) {
+                    if (b[j]) v[j] = (v[j] + (p-f)*b[j]) % p;
+                }
+            } else {
+                uint64_t inv = modInverse(v[c],p);
+
+                for (int j=c; j<cols; ++j) {
+                    v[j] = v[j]*inv % p;
+                }
+
+                basisOf[c] = basis.size();
+                basis.push_back(v);
+                independent.push_back(r);
+                break;
+            }
+        }
+    }
+
+    return independent;
+}
+
+uint64_t modDet(vector<vector<uint64_t>> m, uint64_t p) {
+    size_t n = m.size();
+    uint64_t det = 1;
+
+    for (size_t c=0; c<n; ++c) {
+        size_t r=c;
+        while (r<n && !m[r][c]) ++r;
+
+        if (r == n) return 0;
+
+        if (r != c) {
+            swap(m[r],m[c]);
+            det = (p-det) % p;
+        }
+
+        det = det*m[c][c] % p;
+
+        uint64_t inv = modInverse(m[c][c],p);
+
+        for (r=c+1; r<n; ++r) {
+            if (!m[r][c]) continue;
+
+            uint64_t f = m[r][c]*inv % p;
+
+            for (size_t j=c; j<n; ++j) {
+                if (m[c][j]) m[r][j] = (m[r][j] + (p-f)*m[c][j]) % p;
+            }
+        }
+    }
+
+    return det;
+}
+
+vector<uint64_t> modInterpolate(const vector<uint64_t> &x, const vector<uint64_t> &y, uint64_t p) {
+    size_t n = x.size();
+    vector<uint64_t> d(y);
+    vector<uint64_t> c(n,0);
+
+    if (n == 0) return c;
+
+    // divided differences
+    for (size_t j=1; j<n; ++j) {
+        for (size_t i=n-1; i>=j; --i) {
+            d[i] = (d[i] + p - d[i-1]) % p * modInverse((x[i] + p - x[i-j]) % p,p) % p;
+        }
+    }
+
+    // expand the newton form
+    c[0] = d[n-1];
+
+    for (size_t i=n-1; i-- > 0;) {
+        for (size_t k=n-1; k>=1; --k) {
+            c[k] = (c[k-1] + (p - x[i])*c[k]) % p;
+        }
+        c[0] = ((p - x[i])*c[0] + d[i]) % p;
+    }
+
+    return c;
+}
+
+uint64_t modPolyEval(const vector<uint64_t> &c, uint64_t x, uint64_t p) {
+    uint64_t r = 0;
+
+    for (size_t i=c.size(); i-- > 0;) {
+        r = (r*x + c[i]) % p;
+    }
+
+    return r;
+}
+
+vector<uint64_t> modPolyDivide(const vector<uint64_t> &c, uint64_t r, uint64_t p) {
+    if (c.size() < 2) return vector<uint64_t>();
+
+    vector<uint64_t> q(c.size()-1);
+    uint64_t acc = 0;
+
+    for (size_t i=c.size(); i-- > 1;) {
+        acc = (acc*r + c[i]) % p;
+        q[i-1] = acc;
+    }
+
+    return q;
+}
+
+vector<int> modRowEchelon(vector<vector<uint64_t>> &m, uint64_t p) {
+    vector<int> pivots;
+    size_t rows = m.size();
+    size_t cols = rows ? m[0].size() : 0;
+    size_t rk = 0;
+
+    for (size_t c=0; c<cols && rk<rows; ++c) {
+        size_t r=rk;
+        while (r<rows && !m[r][c]) ++r;
+
+        if (r == rows) continue;
+
+        swap(m[r],m[rk]);
+
+        uint64_t inv = modInverse(m[rk][c],p);
+
+        for (size_t j=c; j<cols; ++j) {
+            m[rk][j] = m[rk][j]*inv % p;
+        }
+
+        for (r=0; r<rows; ++r) {
+            if (r == rk || !m[r][c]) continue;
+
+            uint64_t f = m[r][c];
+
+            for (size_t j=c; j<cols; ++j) {
+                if (m[rk][j]) m[r][j] = (m[r][j] + (p-f)*m[rk][j]) % p;
+            }
+        }
+
+        pivots.push_back(c);
+        ++rk;
+    }
+
+    return pivots;
+}
+
+static void polyTrim(vector<uint64_t> &a) {
+    while (!a.empty() && !a.back()) a.pop_back();
+}
+
+static vector<uint64_t> polyMul(const vector<uint64_t> &a, const vector<uint64_t> &b, uint64_t p) {
+    if (a.empty() || b.empty()) return vector<uint64_t>();
+
+    vector<uint64_t> c(a.size()+b.size()-1,0);
+
+    for (size_t i=0; i<a.size(); ++i) {
+        if (!a[i]) continue;
+        for (size_t j=0; j<b.size(); ++j) {
+            c[i+j] = (c[i+j] + a[i]*b[j]) % p;
+        }
+    }
+
+    polyTrim(c);
+    return c;
+}
+
+static vector<uint64_t> polySub(vector<uint64_t> a, const vector<uint64_t> &b, uint64_t p) {
+    if (a.size() < b.size()) a.resize(b.size(),0);
+
+    for (size_t i=0; i<b.size(); ++i) {
+        a[i] = (a[i] + p - b[i]) % p;
+    }
+
+    polyTrim(a);
+    return a;
+}
+
+// a = q*b + r, b must not be zero
+static void polyDivMod(vector<uint64_t> a, const vector<uint64_t> &b, uint64_t p, vector<uint64_t> &q, vector<uint64_t> &r) {
+    uint64_t inv = modInverse(b.back(),p);
+
+    polyTrim(a);
+    q.assign(a.size() >= b.size() ? a.size()-b.size()+1 : 0,0);
+
+    for (size_t i=a.size(); i-- >= b.size();) {
+        uint64_t f = a[i]*inv % p;
+        if (!f) continue;
+
+        q[i-b.size()+1] = f;
+
+        for (size_t j=0; j<b.size(); ++j) {
+            a[i-b.size()+1+j] = (a[i-b.size()+1+j] + (p-f)*b[j]) % p;
+        }
+    }
+
+    polyTrim(q);
+    polyTrim(a);
+    r = a;
+}
+
+/*
+ *  Extended euclid on (prod(t-x_i), interpolating polynomial). Every remainder r_i with its cofactor t_i
+ *  solves r_i = t_i*f mod prod(t-x_i), the candidate after the quotient of highest degree is the
+ *  solution of minimal degree (maximal quotient rational reconstruction).
+ */
+bool modRatInterpolate(const vector<uint64_t> &x, const vector<uint64_t> &y, uint64_t p, vector<uint64_t> &num, vector<uint64_t> &den) {
+    vector<uint64_t> f = modInterpolate(x,y,p);
+    polyTrim(f);
+
+    if (f.empty()) {
+        num.clear();
+        den.assign(1,1);
+        return true;
+    }
+
+    vector<uint64_t> m(1,1);
+    for (auto xi : x) {
+        m = polyMul(m,{(p-xi)%p,1},p);
+    }
+
+    vector<uint64_t> r0 = m, r1 = f;
+    vector<uint64_t> t0, t1(1,1);
+    vector<uint64_t> q, r;
+    int best = -1;
+
+    while (!r1.empty()) {
+        polyDivMod(r0,r1,p,q,r);
+
+        if ((int)q.size()-1 > best) {
+            best = q.size()-1;
+            num = r1;
+            den = t1;
+        }
+
+        vector<uint64_t> t = polySub(t0,polyMul(q,t1,p),p);
+
+        r0.swap(r1);
+        r1.swap(r);
+        t0.swap(t1);
+        t1.swap(t);
+    }
+
+    if (den.empty() || num.size()+den.size() > x.size()+1) return false;
+
+    for (auto xi : x) {
+        if (!modPolyEval(den,xi,p)) return false;
+    }
+
+    uint64_t inv = modInverse(den.back(),p);
+
+    for (auto &c : num) c = c*inv % p;
+    for (auto &c : den) c = c*inv % p;
+
+    return true;
+}
+
+modbig_t modCRT(modbig_t u, modbig_t m, uint64_t v, uint64_t p) {
+    uint64_t um = u % p;
+    uint64_t h = (v + p - um) % p * modInverse(m % p,p) % p;
+
+    return u + m*h;
+}
+
+static modsbig_t isqrt(modsbig_t n) {
+    modsbig_t r = (modsbig_t)sqrtl((long double)n);
+
+    while (r > 0 && r*r > n) --r;
+    while ((r+1)*(r+1) <= n) ++r;
+
+    return r;
+}
+
+// a/b = u mod m with |a|,b <= sqrt(m/2) (Wang)
+bool modRatReconstruct(modbig_t u, modbig_t m, modsbig_t &a, modsbig_t &b) {
+    modsbig_t bound = isqrt((modsbig_t)(m/2));
+    modsbig_t r0 = m, r1 = u % m;
+    modsbig_t s0 = 0, s1 = 1;
+
+    while (r1 > bound) {
+        modsbig_t q = r0/r1;
+        modsbig_t r = r0 - q*r1;
+        modsbig_t s = s0 - q*s1;
+
+        r0 = r1; r1 = r;
+        s0 = s1; s1 = s;
+    }
+
+    if (s1 < 0) {
+        s1 = -s1;
+        r1 = -r1;
+    }
+
+    if (s1 == 0 || s1 > bound) return false;
+
+    modsbig_t g0 = r1 < 0 ? -r1 : r1, g1 = s1;
+    while (g1) {
+        modsbig_t g = g0 % g1;
+        g0 = g1;
+        g1 = g;
+    }
+
+    if (g0 != 1) return false;
+
+    a = r1;
+    b = s1;
+    return true;
+}
+
+uint64_t modReduce(modsbig_t a, uint64_t p) {
+    modsbig_t r = a % (modsbig_t)p;
+    return r < 0 ? (uint64_t)(r + p) : (uint64_t)r;
+}
+
+string modBigStr(modsbig_t a) {
+    bool neg = a < 0;
+    string str;
+
+    if (neg) a = -a;
+
+    do {
+        str += (char)('0' + (int)(a % 10));
+        a /= 10;
+    } while (a);
+
+    if (neg) str += '-';
+
+    reverse(str.begin(),str.end());
+    return str;
+}
@@ -0,0 +1,228 @@
+// vim: set expandtab shiftwidth=4 tabstop=4:
+
+/*
+ *  src/Session.cpp
+ * 
+ *  Copyright (C) 2017 Mario Prausa 
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <Session.h>
+#include <fstream>
+#include <stdexcept>
+#include <algorithm>
+#include <cstdlib>
+#include <unistd.h>
+#include <thread>
+#include <atomic>
+using namespace std;
+
+#include "functions_fer.h"
+
+Session::Session(const string &path, bool verbose) : path(path), verbose(verbose) {
+    _generation = 0;
+    pool = NULL;
+}
+
+Session::~Session() {
+    if (pool) delete pool;
+}
+
+Fermat *Session::create() const {
+    Fermat *fermat = new Fermat(path,verbose);
+
+    if (active != "") {
+        fermat->addSymbol(active);
+        (*fermat)("&(P="+_polymods.at(active)+",1)");
+    }
+
+    for (auto &e : entries) {
+        switch (e.type) {
+            case entry_t::Symbol:
+                if (e.str == active) break;
+                fermat->addSymbol(e.str);
+                break;
+            case entry_t::Command:
+                (*fermat)(e.str);
+                break;
+            case entry_t::Functions:
+                source(fermat);
+                break;
+        }
+    }
+
+    return fermat;
+}
+
+void Session::addSymbol(Fermat *fermat, const string &symbol) {
+    fermat->addSymbol(symbol);
+    entries.push_back({entry_t::Symbol,symbol});
+    ++_generation;
+}
+
+void Session::dropSymbol(Fermat *fermat, const string &symbol) {
+    fermat->dropSymbol(symbol);
+
+    for (auto it = entries.rbegin(); it != entries.rend(); ++it) {
+        if (it->type == entry_t::Symbol && it->str == symbol) {
+            entries.erase(next(it).base());
+            break;
+        }
+    }
+
+    ++_generation;
+}
+
+void Session::execute(Fermat *fermat, const string &command) {
+    (*fermat)(command);
+    entries.push_back({entry_t::Command,command});
+    ++_generation;
+}
+
+void Session::sourceFunctions(Fermat *fermat) {
+    source(fermat);
+    entries.push_back({entry_t::Functions,""});
+    ++_generation;
+}
+
+void Session::addPolymod(const string &symbol, const string &poly) {
+    _polymods[symbol] = poly;
+}
+
+set<string> Session::polymods() const {
+    set<string> symbols;
+
+    for (auto &pm : _polymods) {
+        symbols.insert(pm.first);
+    }
+
+    return symbols;
+}
+
+void Session::setPolymod(const string &symbol) {
+    if (symbol != "" && !_polymods.count(symbol)) {
+        throw invalid_argument("unknown polymod "+symbol+".");
+    }
+
+    active = symbol;
+    ++_generation;
+}
+
+string Session::polymod() const {
+    return active;
+}
+
+int Session::generation() const {
+    return _generation;
+}
+
+WorkerPool &Session::workers() {
+    if (!pool) pool = new WorkerPool(this);
+    return *pool;
+}
+
+void Session::source(Fermat *fermat) {
+    bool first=true;
+    string tmpdir = getenv("TMPDIR")?getenv("TMPDIR"):"/tmp";
+    tmpdir += "/epsilonXXXXXX";
+
+    mkdtemp(&tmpdir[0]);
+
+    ofstream file(tmpdir+"/functions.fer");
+    if (!file.is_open()) {
+        throw invalid_argument("unable to open "+tmpdir+"/functions.fer");
+    }
+
+    for (auto line : _functions_fer) {
+        line.erase(line.find_last_not_of(" \t\r")+1);
+        if (line == "") continue;
+
+        if (!first) file << endl;
+        file << line;
+        first=false;
+    }
+
+    file.close();
+
+    (*fermat)("&(U=0)");
+    (*fermat)("&(R=\'"+tmpdir+"/functions.fer\')"); 
+    (*fermat)("&(U=1)");
+
+    unlink((tmpdir+"/functions.fer").c_str());
+    rmdir(tmpdir.c_str());
+}
+
+WorkerPool::WorkerPool(const Session *session) : session(session) {
+    generation = session->generation();
+}
+
+WorkerPool::~WorkerPool() {
+    clear();
+}
+
+void WorkerPool::clear() {
+    for (auto w : workers) {
+        if (w) delete w;
+    }
+
+    workers.clear();
+    broken.clear();
+}
+
+bool WorkerPool::run(int threads, size_t n, const function<void(Fermat*,size_t,size_t)> &job) {
+    if (generation != session->generation()) {
+        clear();
+        generation = session->generation();
+    }
+
+    for (size_t t=0; t<workers.size(); ++t) {
+        if (broken[t]) {
+            delete workers[t];
+            workers[t] = NULL;
+            broken[t] = false;
+        }
+    }
+
+    size_t nworkers = min((size_t)max(threads,1),n);
+
+    if (workers.size() < nworkers) {
+        workers.resize(nworkers,NULL);
+        broken.resize(nworkers,false);
+    }
+
+    atomic<size_t> next(0);
+    vector<thread> pool;
+
+    for (size_t t=0; t<nworkers; ++t) {
+        pool.push_back(thread([&,t]() {
+            try {
+                if (!workers[t]) workers[t] = session->create();
+
+                for (size_t i; (i = next++) < n;) {
+                    job(workers[t],i,t);
+                }
+            } catch (const exception &e) {
+                broken[t] = true;
+            }
+        }));
+    }
+
+    for (auto &t : pool) {
+        t.join();
+    }
+
+    // broken workers are kept until the next call, callers may still hold data of them
+    return find(broken.begin(),broken.end(),true) == broken.end();
+}
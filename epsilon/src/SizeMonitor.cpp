@@ -0,0 +1,77 @@
+// vim: set expandtab shiftwidth=4 tabstop=4:
+
+/*
+ *  src/SizeMonitor.cpp
+ * 
+ *  Copyright (C) 2017 Mario Prausa 
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <SizeMonitor.h>
+#include <iomanip>
+#include <stdexcept>
+using namespace std;
+
+SizeMonitor::SizeMonitor(string filename) {
+    file.open(filename);
+
+    if (!file.is_open()) {
+        throw invalid_argument("unable to open file.");
+    }
+
+    file << "#step\tnonzero\tterms\tepdeg\ttime\ttransformation" << endl;
+
+    step = 0;
+    clock_gettime(CLOCK_MONOTONIC_COARSE,&start);
+}
+
+SizeMonitor::~SizeMonitor() {
+    if (file.is_open()) file.close();
+}
+
+SizeMonitor::sizes_t SizeMonitor::measure(const vector<FermatArray> &arrays) {
+    sizes_t sizes;
+
+    sizes.nonzero = sizes.terms = sizes.epdeg = 0;
+
+    if (arrays.empty()) return sizes;
+
+    // all statistics are accumulated inside fermat, we only fetch the three totals.
+    Fermat *fermat = arrays.front().fer();
+    FermatArray s(fermat,1,3);
+    s.assign("0");
+
+    for (auto &a : arrays) {
+        if (a.rows() == 0 || a.cols() == 0) continue;
+        (*fermat)("Sizes(["+a.name()+"],["+s.name()+"])");
+    }
+
+    sizes.nonzero = stol(s(1,1).str());
+    sizes.terms = stol(s(1,2).str());
+    sizes.epdeg = stol(s(1,3).str());
+
+    return sizes;
+}
+
+void SizeMonitor::record(const string &label, const vector<FermatArray> &arrays) {
+    struct timespec now;
+    sizes_t sizes = measure(arrays);
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE,&now);
+
+    double elapsed = (now.tv_sec-start.tv_sec) + (now.tv_nsec-start.tv_nsec)*1e-9;
+
+    file << ++step << "\t" << sizes.nonzero << "\t" << sizes.terms << "\t" << sizes.epdeg << "\t" << fixed << setprecision(3) << elapsed << "\t" << label << endl;
+}
@@ -0,0 +1,145 @@
+// vim: set expandtab shiftwidth=4 tabstop=4:
+
+/*
+ *  src/Sylvester.cpp
+ * 
+ *  Copyright (C) 2017 Mario Prausa 
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <Sylvester.h>
+#include <JordanSystem.h>
+#include <Echelon.h>
+#include <sstream>
+#include <stdexcept>
+using namespace std;
+
+Sylvester::Sylvester() : fermat(NULL) {
+}
+
+Sylvester::Sylvester(const FermatArray &C, const FermatArray &A) : fermat(C.fer()) {
+    decompose(C,P,cblocks);
+    decompose(A,Q,ablocks);
+
+    Pinv = P.inverse();
+    Qinv = Q.inverse();
+}
+
+void Sylvester::decompose(const FermatArray &M, FermatArray &P, vector<block_t> &blocks) {
+    JordanSystem system;
+    eigenvalues_t evs = findEigenvalues(M,100);
+
+    jordanSystem(M,evs,system);
+
+    P = FermatArray(M.fer(),M.rows(),M.cols());
+    blocks.clear();
+
+    int col=1;
+    for (auto &b : system) {
+        blocks.push_back({col,(int)b.rootvectors.size(),b.ev});
+
+        for (auto &v : b.rootvectors) {
+            P.setColumn(col++,v);
+        }
+    }
+
+    if (col != M.cols()+1) {
+        throw invalid_argument("wrong number of root vectors");
+    }
+}
+
+FermatArray Sylvester::solve(int k, const FermatArray &R) const {
+    FermatArray Rj = Pinv*R*Q;
+    FermatArray H(fermat,Rj.rows(),Rj.cols());
+    FermatExpression ep(fermat,"ep");
+
+    H.assign("0");
+
+    // Jc*H - H*Ja + k*H = Rj decouples into the pairs of jordan blocks. within a pair
+    // delta*H(i,j) + H(i+1,j) - H(i,j-1) = Rj(i,j), with delta = ev(a) - ev(b) + k.
+    for (auto &a : cblocks) {
+        for (auto &b : ablocks) {
+            int du = a.ev.u - b.ev.u + k;
+            int dv = a.ev.v - b.ev.v;
+
+            if (du == 0 && dv == 0) {
+                solveResonant(a,b,Rj,H);
+                continue;
+            }
+
+            stringstream strm;
+            strm << "(" << du << ")+(" << dv << ")*ep";
+            FermatExpression delta(fermat,strm.str());
+
+            vector<vector<FermatExpression>> h(a.size+2,vector<FermatExpression>(b.size+1,FermatExpression(fermat,0)));
+
+            for (int i=a.size; i>=1; --i) {
+                for (int j=1; j<=b.size; ++j) {
+                    FermatExpression r = Rj(a.pos+i-1,b.pos+j-1) - h[i+1][j] + h[i][j-1];
+
+                    if (r.str() == "0") continue;
+
+                    h[i][j] = r/delta;
+                    H.set(a.pos+i-1,b.pos+j-1,h[i][j]);
+                }
+            }
+        }
+    }
+
+    return P*H*Qinv;
+}
+
+void Sylvester::solveResonant(const block_t &a, const block_t &b, const FermatArray &R, FermatArray &H) const {
+    Echelon echelon(fermat);
+    int rhs = a.size*b.size+1;
+
+    #define pos(i,j) (((i)-1)*b.size+(j))
+
+    for (int i=1; i<=a.size; ++i) {
+        for (int j=1; j<=b.size; ++j) {
+            map<int,FermatExpression> row;
+
+            row[rhs] = R(a.pos+i-1,b.pos+j-1);
+
+            if (i < a.size) row[pos(i+1,j)] = FermatExpression(fermat,1);
+            if (j > 1) row[pos(i,j-1)] = FermatExpression(fermat,-1);
+
+            echelon.set(row);
+        }
+    }
+
+    echelon.run();
+
+    for (auto &r : echelon) {
+        auto it = r.begin();
+        int p = it->first;
+
+        if (p == rhs) {
+            throw invalid_argument("linear system has no solution.");
+        }
+
+        if (r.size() < 2) continue;
+
+        for (auto it2=r.begin(); it2 != r.end(); ++it2) {
+            it = it2;
+        }
+       
+        if (it->first != rhs) continue; 
+
+        H.set(a.pos+(p-1)/b.size,b.pos+(p-1)%b.size,it->second);
+    }
+
+    #undef pos
+}
@@ -25,12 +25,18 @@
 #include <TransformationQueue.h>
 #include <FermatException.h>
 #include <Echelon.h>
+#include <Modular.h>
+#include <Sylvester.h>
 #include <fstream>
 #include <iostream>
 #include <sstream>
 #include <iomanip>
 #include <stdexcept>
 #include <algorithm>
+#include <thread>
+#include <atomic>
+#include <random>
+#include <array>
 using namespace std;
 
 FermatExpression infinity;
@@ -68,18 +74,26 @@ bool System::singLess::operator() (const FermatExpression &a, const FermatExpres
     return as < bs;
 }
 
-System::System(Fermat *fermat, bool echfer) : tqueue(fermat) {
+System::System(Fermat *fermat, const SystemOptions &options) : tqueue(fermat) {
     this->fermat = fermat;
-    this->echfer = echfer;
+    this->options = options;
+    sizemon = NULL;
+    session = NULL;
+    tqueue.setSystem(this);
+    ntrans = 0;
 }
 
-System::System(Fermat *fermat, string filename, int start, int end, bool echfer) : tqueue(fermat) {
+System::System(Fermat *fermat, string filename, int start, int end, const SystemOptions &options) : tqueue(fermat) {
 	string str;
 	ifstream file(filename);
     int r;
     
     this->fermat = fermat;
-    this->echfer = echfer;
+    this->options = options;
+    sizemon = NULL;
+    session = NULL;
+    tqueue.setSystem(this);
+    ntrans = 0;
 
     if (!file.is_open()) {
         throw invalid_argument("unable to open file.");
@@ -221,7 +235,11 @@ System::System(const System &orig, int start, int end) : tqueue(orig.tqueue) {
     int r;
 
     fermat = orig.fermat;
-    echfer = orig.echfer;
+    options = orig.options;
+    sizemon = NULL;
+    session = NULL;
+    tqueue.setSystem(this);
+    ntrans = 0;
  
     kmaxC = kmax = -1;
 
@@ -330,7 +348,11 @@ System::System(const System &orig, const FermatArray &left, const FermatArray &r
     TriangleBlockMatrix mat;
 
     fermat = orig.fermat;
-    echfer = orig.echfer;
+    options = orig.options;
+    sizemon = NULL;
+    session = NULL;
+    tqueue.setSystem(this);
+    ntrans = 0;
     nullMatrix = orig.nullMatrix;
     singularities = orig.singularities;
     kmaxC = orig.kmaxC;
@@ -382,7 +404,11 @@ System::System(const System &orig, int ep) : tqueue(orig.fermat) {
     TriangleBlockMatrix mat;
     
     fermat = orig.fermat;
-    echfer = orig.echfer;
+    options = orig.options;
+    sizemon = NULL;
+    session = NULL;
+    tqueue.setSystem(this);
+    ntrans = 0;
     nullMatrix = orig.nullMatrix;
     singularities = orig.singularities;
     kmaxC = orig.kmaxC;
@@ -454,9 +480,101 @@ map<FermatExpression,FermatArray> System::exportFuchs() const {
     return fuchs;
 }
 
+map<string,int> System::countSymbols(const set<string> &symbols) const {
+    map<string,int> counts;
+
+    auto ident = [](char c) {
+        return isalnum(c) || c == '_';
+    };
+
+    auto scan = [&](const string &str) {
+        for (auto &sym : symbols) {
+            for (size_t pos = str.find(sym); pos != string::npos; pos = str.find(sym,pos+1)) {
+                size_t end = pos+sym.size();
+
+                if (pos > 0 && ident(str[pos-1])) continue;
+                if (end < str.size() && ident(str[end])) continue;
+
+                counts[sym]++;
+            }
+        }
+    };
+
+    // leftreduce and leftfuchsify test entries of B and E for zero as well
+    auto scanBlocks = [&](const TriangleBlockMatrix &m) {
+        for (const FermatArray *X : {&m.B,&m.C,&m.E}) {
+            if (X->rows() > 0 && X->cols() > 0) scan(X->str());
+        }
+    };
+
+    for (auto &a : _A) {
+        scanBlocks(a.second);
+    }
+
+    for (auto &b : _B) {
+        scanBlocks(b.second);
+    }
+
+    return counts;
+}
+
 TransformationQueue *System::transformationQueue() {
     return &tqueue;
 }
+
+void System::setMonitor(SizeMonitor *sizemon) {
+    this->sizemon = sizemon;
+}
+
+void System::setSession(Session *session) {
+    this->session = session;
+    tqueue.setWorkers(session,options.threads);
+}
+
+/*
+ *  a single expression which identifies the residues: u^T*A*v for fixed vectors u and v, summed over all
+ *  blocks with distinct weights. ep is set to a number to keep the expression small.
+ */
+string System::fingerprint() const {
+    FermatExpression fp(fermat,"0");
+    FermatExpression epval(fermat,"1009/997");
+    int n = 0;
+
+    auto add = [&](const FermatArray &X) {
+        ++n;
+        if (X.rows() == 0 || X.cols() == 0) return;
+
+        stringstream u,v;
+
+        u << "{{";
+        for (int i=0; i<X.rows(); ++i) {
+            u << (i?",":"") << i+1;
+        }
+        u << "}}";
+
+        v << "{";
+        for (int j=0; j<X.cols(); ++j) {
+            v << (j?",":"") << "{" << 2*j+1 << "}";
+        }
+        v << "}";
+
+        FermatArray s = FermatArray(fermat,u.str())*X.subst("ep",epval)*FermatArray(fermat,v.str());
+        fp += s(1,1)*n;
+    };
+
+    for (auto &a : _A) {
+        add(a.second.B);
+        add(a.second.C);
+        add(a.second.E);
+    }
+    for (auto &b : _B) {
+        add(b.second.B);
+        add(b.second.C);
+        add(b.second.E);
+    }
+
+    return fp.str();
+}
     
 void System::fuchsify() {
     FermatExpression x1,x2;
@@ -576,25 +694,17 @@ void System::normalize() {
 }
 
 void System::factorep() {
-    FermatExpression ep(fermat,"ep");
-    int N = nullMatrix.C.rows();
     // TODO: check eigenvalues
 
-    set<string> symbols;
-    int rk;
-
-    fermat->addSymbol("mu");
-    FermatExpression mu(fermat,"mu");
+    residues_t residues;
 
-    symbols.insert("mu");
-
-    EchelonBase *echelon;
-
-    if (echfer) {
-        echelon = new EchelonFermat(fermat,N*N*singularities.size(),N*N+1);
+    // worker sessions have to know mu as well
+    if (session) {
+        session->addSymbol(fermat,"mu");
     } else {
-        echelon = new Echelon(fermat);
+        fermat->addSymbol("mu");
     }
+    FermatExpression mu(fermat,"mu");
 
     for (auto it = singularities.begin(); it != singularities.end(); ++it) {
         FermatExpression xj = it->first;
@@ -603,163 +713,126 @@ void System::factorep() {
         FermatArray Aep = A(xj,0).C;
         FermatArray Amu = Aep.subst("ep",mu);
 
-        #define pos(i,j) (((i)-1)*N+(j))
-
-        for (int i=1; i<=N; ++i) {
-            for (int k=1; k<=N; ++k) {
-                map<int,FermatExpression> row;
-                for (int j=1; j<=N; ++j) {
-                    if (row.count(pos(j,k))) {
-                        row[pos(j,k)] = row[pos(j,k)] + Aep(i,j)/ep;
-                    } else {
-                        row[pos(j,k)] = Aep(i,j)/ep;
-                    }
+        residues[xj] = {Aep,Amu};
+    }
 
-                    if (row.count(pos(i,j))) {
-                        row[pos(i,j)] = row[pos(i,j)] - Amu(j,k)/mu;
-                    } else {
-                        row[pos(i,j)] = -Amu(j,k)/mu;
-                    }
-                }
-                echelon->set(row);
-            }
-        }
+    FermatArray T = factorepSolve(residues,mu);
 
-        #undef pos
+    if (session) {
+        session->dropSymbol(fermat,"mu");
+    } else {
+        fermat->dropSymbol("mu");
     }
 
-    rk = echelon->run(); 
-   
-    FermatArray T(fermat,N,N);
-    T.assign("0");
-
-    int pos=0;
+    transform(T);
+}
 
-    #define rpos(p) (((p)-1)/N+1)
-    #define cpos(p) ((((p)-1)%N)+1)
+void System::factorep(int mu) {
+    if (mu == 0) {
+        throw invalid_argument("mu must be != 0");
+    }
 
-    for (auto &r : *echelon) {
-        for (int c=pos+1; c<r.col1(); ++c) {
-            stringstream strm;
-            string sym;
+    // TODO: check eigenvalues
 
-            strm << "t" << rpos(c) << "x" << cpos(c);
-            sym = strm.str();
+    residues_t residues;
 
-            if (!symbols.count(sym)) {
-                fermat->addSymbol(sym);
-                symbols.insert(sym);
-                cout << "adding symbol " << sym << "." << endl;
-            }
+    try {
+        for (auto it = singularities.begin(); it != singularities.end(); ++it) {
+            FermatExpression xj = it->first;
+            if (xj == infinity) continue;
 
-            T.set(rpos(c),cpos(c),FermatExpression(fermat,sym));
-        }
-       
-        pos = r.col1();
- 
-        for (auto &e : r) {
-            if (e.first == pos) {
-                if (e.second.str() != "1") {
-                    throw invalid_argument("not in row reduced echelon form (this is a bug)");
-                }
-                continue;
-            }
-            
-            stringstream strm;
-            string sym;
-               
-            strm << "t" << rpos(e.first) << "x" << cpos(e.first);
-            sym = strm.str();
-            
-            if (!symbols.count(sym)) {
-                fermat->addSymbol(sym);
-                symbols.insert(sym);
-                cout << "adding symbol " << sym << "." << endl;
-            }
+            FermatArray Aep = A(xj,0).C;
+            FermatArray Amu = Aep.subst("ep",mu);
 
-            T.set(rpos(pos),cpos(pos),T(rpos(pos),cpos(pos))-e.second*FermatExpression(fermat,sym));
+            residues[xj] = {Aep,Amu};
         }
+    } catch(const FermatDivByZero &e) {
+        stringstream strm;
+        strm << "system is singular at mu=" << mu << ".";
+        throw invalid_argument(strm.str());
     }
 
-    for (int c=pos+1; c<=N*N; ++c) {
-        stringstream strm;
-        string sym;
+    FermatArray T = factorepSolve(residues,FermatExpression(fermat,mu));
 
-        strm << "t" << rpos(c) << "x" << cpos(c);
-        sym = strm.str();
+    transform(T);
+}
 
-        if (!symbols.count(sym)) {
-            fermat->addSymbol(sym);
-            symbols.insert(sym);
-            cout << "adding symbol " << sym << "." << endl;
+FermatArray System::factorepSolve(const residues_t &residues, const FermatExpression &mu) {
+    FermatExpression ep(fermat,"ep");
+    int N = nullMatrix.C.rows();
+    vector<FermatArray> basis;
+    vector<int> selected;
+    bool filtered=false;
+    bool singular;
+    int rk;
+
+    // substitute the chosen mu and check the result symbolically once
+    auto finish = [&](FermatArray T, int mu0) {
+        if (mu.str() == "mu") {
+            T = T.subst("mu",mu0);
         }
 
-        T.set(rpos(c),cpos(c),FermatExpression(fermat,sym));
-    }
+        if (T.det().str() == "0") {
+            throw invalid_argument("transformation is singular.");
+        }
 
-    #undef rpos
-    #undef cpos
+        return T;
+    };
 
-    delete echelon;
+    int mu0;
 
-    FermatExpression det = T.det();
+    if (factorepStructured(residues,mu,basis,singular)) {
+        FermatArray T = factorepChoose(basis,mu,mu0);
+        return finish(T,mu0);
+    }
 
-    if (det.str() == "0") {
+    if (singular) {
         throw invalid_argument("transformation is singular.");
     }
-   
-    for (auto it=symbols.begin(); it != symbols.end(); ++it) {
-        for (int _sym0=0; _sym0 <= 200; ++_sym0) {
-            int sym0 = ((_sym0&1)?1:-1)*((_sym0+1)>>1);
-            try {
-                FermatExpression det0 = det.subst(*it,sym0);
-                if (det0.str() != "0") {
-                    cout << *it << " -> " << sym0 << endl;
-                    det = det0;
-                    T = T.subst(*it,sym0);
-                    fermat->dropSymbol(*it);
+
+    if (options.modular) {
+        FermatExpression mu1;
+
+        filtered = factorepSample(residues,mu,selected);
+
+        if (filtered && factorepModular(residues,mu,selected,basis,mu1)) {
+            FermatArray T = factorepChoose(basis,mu1,mu0);
+            bool valid=true;
+
+            for (auto &res : residues) {
+                FermatArray Amu = mu.str() == "mu" ? res.second.second.subst("mu",mu1) : res.second.second;
+
+                if (!(res.second.first*T/ep - T*Amu/mu1).isZero()) {
+                    valid = false;
                     break;
                 }
-            } catch (const FermatDivByZero &e) {
             }
-        }
-    }
 
-    transform(T);
-}
+            if (valid) return finish(T,mu0);
 
-void System::factorep(int mu) {
-    if (mu == 0) {
-        throw invalid_argument("mu must be != 0");
+            cout << "WARNING: modular solution does not solve the system. solving symbolically." << endl;
+        }
     }
 
-    FermatExpression ep(fermat,"ep");
-    int N = nullMatrix.C.rows();
-    // TODO: check eigenvalues
+    for (;;) {
+        EchelonBase *echelon = newEchelon(N*N*singularities.size(),N*N+1,N*N);
 
-    set<string> symbols;
-    int rk;
-    
-    EchelonBase *echelon;
+        auto sel = selected.begin();
+        int rownum=0;
 
-    if (echfer) {
-        echelon = new EchelonFermat(fermat,N*N*singularities.size(),N*N+1);
-    } else {
-        echelon = new Echelon(fermat);
-    }
-
-    try {
-        for (auto it = singularities.begin(); it != singularities.end(); ++it) {
-            FermatExpression xj = it->first;
-            if (xj == infinity) continue;
-
-            FermatArray Aep = A(xj,0).C;
-            FermatArray Amu = Aep.subst("ep",mu);
+        for (auto &res : residues) {
+            const FermatArray &Aep = res.second.first;
+            const FermatArray &Amu = res.second.second;
 
             #define pos(i,j) (((i)-1)*N+(j))
 
             for (int i=1; i<=N; ++i) {
-                for (int k=1; k<=N; ++k) {
+                for (int k=1; k<=N; ++k,++rownum) {
+                    if (filtered) {
+                        if (sel == selected.end() || *sel != rownum) continue;
+                        ++sel;
+                    }
+
                     map<int,FermatExpression> row;
                     for (int j=1; j<=N; ++j) {
                         if (row.count(pos(j,k))) {
@@ -780,40 +853,674 @@ void System::factorep(int mu) {
 
             #undef pos
         }
-    } catch(const FermatDivByZero &e) {
+
+        rk = echelon->run(); 
+
+        basis = factorepSolution(echelon);
+
+        delete echelon;
+
+        FermatArray T = factorepChoose(basis,mu,mu0);
+
+        if (!filtered) return finish(T,mu0);
+
+        bool valid=true;
+        for (auto &res : residues) {
+            if (!(res.second.first*T/ep - T*res.second.second/mu).isZero()) {
+                valid = false;
+                break;
+            }
+        }
+
+        if (valid) return finish(T,mu0);
+
+        cout << "WARNING: modular sampling missed equations. solving the full system." << endl;
+        filtered = false;
+    }
+}
+
+bool System::factorepSample(const residues_t &residues, const FermatExpression &mu, vector<int> &selected) {
+    int N = nullMatrix.C.rows();
+    vector<pair<ModArray,ModArray>> mresidues;
+    ModExpression mmu;
+    set<string> syms;
+
+    syms.insert("ep");
+
+    try {
+        mmu = ModExpression(mu.str());
+        mmu.symbols(syms);
+
+        for (auto &res : residues) {
+            mresidues.push_back({ModArray(res.second.first),ModArray(res.second.second)});
+            mresidues.back().first.symbols(syms);
+            mresidues.back().second.symbols(syms);
+        }
+    } catch (const invalid_argument &e) {
+        cout << "WARNING: " << e.what() << " skipping modular sampling." << endl;
+        return false;
+    }
+
+    // every sample uses its own prime and point, unlucky points can only lower the rank.
+    int samples = min(modPrimesCount,max(2,(int)thread::hardware_concurrency()));
+    vector<vector<int>> independent(samples);
+    vector<thread> threads;
+
+    for (int s=0; s<samples; ++s) {
+        threads.push_back(thread([&,s]() {
+            uint64_t p = modPrimes[s];
+            modvalues_t values = modRandomValues(syms,p,s+1);
+            vector<modrow_t> rows;
+
+            try {
+                for (auto &res : mresidues) {
+                    vector<vector<uint64_t>> Aep = res.first.eval(values,p);
+                    vector<vector<uint64_t>> Amu = res.second.eval(values,p);
+                    uint64_t epinv = modInverse(values.at("ep"),p);
+                    uint64_t muinv = modInverse(mmu.eval(values,p),p);
+
+                    #define pos(i,j) (((i)-1)*N+(j)-1)
+
+                    for (int i=1; i<=N; ++i) {
+                        for (int k=1; k<=N; ++k) {
+                            modrow_t row;
+                            for (int j=1; j<=N; ++j) {
+                                row.push_back({pos(j,k),Aep[i-1][j-1]*epinv % p});
+                                row.push_back({pos(i,j),(p - Amu[j-1][k-1]*muinv % p) % p});
+                            }
+                            rows.push_back(row);
+                        }
+                    }
+
+                    #undef pos
+                }
+            } catch (const ModDivByZero &e) {
+                return;
+            }
+
+            independent[s] = modIndependentRows(rows,N*N,p);
+        }));
+    }
+
+    for (auto &t : threads) {
+        t.join();
+    }
+
+    size_t best=0;
+    for (int s=1; s<samples; ++s) {
+        if (independent[s].size() > independent[best].size()) best = s;
+    }
+
+    if (independent[best].empty()) {
+        cout << "WARNING: modular sampling failed." << endl;
+        return false;
+    }
+
+    selected = independent[best];
+
+    cout << "modular sampling: " << selected.size() << " of " << N*N*residues.size() << " equations are independent." << endl;
+
+    return true;
+}
+
+/*
+ *  Solves the selected equations modulo primes instead of symbolically. If mu is symbolic, it is fixed first to
+ *  an integer mu1 where the equations keep their generic pivots and still allow a regular T. For every prime
+ *  the equations are reduced at sample values of ep, each entry of the solution is interpolated as a rational
+ *  function in ep, and the coefficients are lifted to rationals by chinese remaindering. Systems with further
+ *  symbols are left to the symbolic solver.
+ */
+bool System::factorepModular(const residues_t &residues, const FermatExpression &mu, const vector<int> &selected, vector<FermatArray> &basis, FermatExpression &mu1) {
+    int N = nullMatrix.C.rows();
+    bool symbolic = (mu.str() == "mu");
+    vector<pair<ModArray,ModArray>> mresidues;
+    ModExpression mmu;
+    set<string> syms;
+
+    try {
+        mmu = ModExpression(mu.str());
+        mmu.symbols(syms);
+
+        for (auto &res : residues) {
+            mresidues.push_back({ModArray(res.second.first),ModArray(res.second.second)});
+            mresidues.back().first.symbols(syms);
+            mresidues.back().second.symbols(syms);
+        }
+    } catch (const invalid_argument &e) {
+        return false;
+    }
+
+    syms.erase("ep");
+    syms.erase("mu");
+
+    if (!syms.empty()) {
+        cout << "modular solve: the system depends on " << *syms.begin() << ". solving symbolically." << endl;
+        return false;
+    }
+
+    typedef vector<vector<uint64_t>> modmatrix_t;
+
+    // residue, row and column of every selected equation
+    vector<array<int,3>> eqs;
+    auto sel = selected.begin();
+    int rownum=0;
+
+    for (size_t r=0; r<mresidues.size(); ++r) {
+        for (int i=1; i<=N; ++i) {
+            for (int k=1; k<=N; ++k,++rownum) {
+                if (sel == selected.end() || *sel != rownum) continue;
+                ++sel;
+                eqs.push_back({(int)r,i,k});
+            }
+        }
+    }
+
+    // reduced row echelon form of the selected equations at (ep,mu) = (e,m)
+    auto rref = [&](uint64_t p, uint64_t e, uint64_t m, vector<int> &pivots) {
+        modvalues_t values = {{"ep",e},{"mu",m}};
+        vector<modmatrix_t> Aep, Amu;
+
+        for (auto &res : mresidues) {
+            Aep.push_back(res.first.eval(values,p));
+            Amu.push_back(res.second.eval(values,p));
+        }
+
+        uint64_t epinv = modInverse(e,p);
+        uint64_t muinv = modInverse(mmu.eval(values,p),p);
+        modmatrix_t M(eqs.size(),vector<uint64_t>(N*N,0));
+
+        #define pos(i,j) (((i)-1)*N+(j)-1)
+
+        for (size_t q=0; q<eqs.size(); ++q) {
+            int r = eqs[q][0], i = eqs[q][1], k = eqs[q][2];
+
+            for (int j=1; j<=N; ++j) {
+                M[q][pos(j,k)] = (M[q][pos(j,k)] + Aep[r][i-1][j-1]*epinv) % p;
+                M[q][pos(i,j)] = (M[q][pos(i,j)] + p - Amu[r][j-1][k-1]*muinv % p) % p;
+            }
+        }
+
+        #undef pos
+
+        pivots = modRowEchelon(M,p);
+        return M;
+    };
+
+    auto modint = [](long v, uint64_t p) -> uint64_t {
+        return v < 0 ? p - ((uint64_t)(-v) % p) : (uint64_t)v % p;
+    };
+
+    uint64_t p = modPrimes[0];
+    mt19937_64 gen(1);
+    vector<int> pivots;
+
+    // generic pivots: the most pivots found at a few random points
+    for (int s=0; s<3; ++s) {
+        vector<int> piv;
+
+        try {
+            rref(p,gen()%p,gen()%p,piv);
+        } catch (const ModDivByZero &e) {
+            continue;
+        }
+
+        if (piv.size() > pivots.size()) pivots = piv;
+    }
+
+    vector<int> freecols;
+    for (int c=0,q=0; c<N*N; ++c) {
+        if (q < (int)pivots.size() && pivots[q] == c) {
+            ++q;
+        } else {
+            freecols.push_back(c);
+        }
+    }
+
+    int R = pivots.size();
+    int F = freecols.size();
+
+    if (F == 0) {
+        basis.clear();
+        mu1 = mu;
+        return true;
+    }
+
+    long mu0 = 0;
+
+    if (symbolic) {
+        bool found=false;
+
+        for (int _mu0=1; _mu0<200 && !found; ++_mu0) {
+            mu0 = ((_mu0&1)?1:-1)*((_mu0+1)>>1);
+
+            vector<int> piv;
+            modmatrix_t M;
+
+            try {
+                M = rref(p,gen()%p,modint(mu0,p),piv);
+            } catch (const ModDivByZero &e) {
+                continue;
+            }
+
+            if (piv != pivots) continue;
+
+            // a random element of the solution space has to be regular
+            modmatrix_t S(N,vector<uint64_t>(N,0));
+
+            for (int f=0; f<F; ++f) {
+                uint64_t c = gen()%p;
+
+                S[freecols[f]/N][freecols[f]%N] = (S[freecols[f]/N][freecols[f]%N] + c) % p;
+                for (int r=0; r<R; ++r) {
+                    S[pivots[r]/N][pivots[r]%N] = (S[pivots[r]/N][pivots[r]%N] + (p - c*M[r][freecols[f]] % p)) % p;
+                }
+            }
+
+            found = modDet(S,p) != 0;
+        }
+
+        if (!found) return false;
+
+        cout << "mu -> " << mu0 << endl;
+        mu1 = FermatExpression(fermat,(int)mu0);
+    } else {
+        mu1 = mu;
+    }
+
+    // numerators and denominators of all R*F entries modulo one prime
+    typedef vector<pair<vector<uint64_t>,vector<uint64_t>>> images_t;
+    int nthreads = max(1,(int)thread::hardware_concurrency());
+    int npoints = 8;
+
+    auto solve = [&](uint64_t p, unsigned seed, images_t &images) {
+        mt19937_64 gen(seed);
+        vector<uint64_t> xs;
+        vector<vector<uint64_t>> ys(R*F);
+        uint64_t m = modint(mu0,p);
+        int bad = 0;
+
+        images.assign(R*F,{});
+
+        for (;;) {
+            while ((int)xs.size() < npoints+2) {
+                vector<uint64_t> cand;
+                vector<modmatrix_t> res(nthreads);
+                vector<char> ok(nthreads,false);
+                vector<thread> pool;
+
+                while ((int)cand.size() < min(nthreads,npoints+2-(int)xs.size())) {
+                    uint64_t e = gen()%p;
+                    if (e && find(xs.begin(),xs.end(),e) == xs.end() && find(cand.begin(),cand.end(),e) == cand.end()) cand.push_back(e);
+                }
+
+                for (size_t t=0; t<cand.size(); ++t) {
+                    pool.push_back(thread([&,t]() {
+                        vector<int> piv;
+
+                        try {
+                            res[t] = rref(p,cand[t],m,piv);
+                            ok[t] = (piv == pivots);
+                        } catch (const ModDivByZero &e) {
+                        }
+                    }));
+                }
+
+                for (auto &t : pool) {
+                    t.join();
+                }
+
+                for (size_t t=0; t<cand.size(); ++t) {
+                    if (!ok[t]) {
+                        if (++bad > 20) return false;
+                        continue;
+                    }
+
+                    xs.push_back(cand[t]);
+                    for (int r=0; r<R; ++r) {
+                        for (int f=0; f<F; ++f) {
+                            ys[r*F+f].push_back(res[t][r][freecols[f]]);
+                        }
+                    }
+                }
+            }
+
+            vector<uint64_t> x(xs.begin(),xs.begin()+npoints);
+            bool ok=true;
+
+            for (int q=0; q<R*F && ok; ++q) {
+                vector<uint64_t> y(ys[q].begin(),ys[q].begin()+npoints);
+
+                ok = modRatInterpolate(x,y,p,images[q].first,images[q].second);
+
+                for (size_t i=npoints; ok && i<xs.size(); ++i) {
+                    uint64_t d = modPolyEval(images[q].second,xs[i],p);
+                    ok = d && modPolyEval(images[q].first,xs[i],p) == d*ys[q][i] % p;
+                }
+            }
+
+            if (ok) return true;
+            if (npoints >= 1024) return false;
+
+            npoints *= 2;
+        }
+    };
+
+    images_t images;
+
+    if (!solve(modPrimes[0],2,images)) {
+        cout << "modular solve: interpolation in ep failed. solving symbolically." << endl;
+        return false;
+    }
+
+    // chinese remaindering of all coefficients, until the reconstruction is confirmed by the next prime
+    vector<vector<modbig_t>> U;
+    modbig_t M = modPrimes[0];
+
+    for (auto &im : images) {
+        vector<modbig_t> u(im.first.begin(),im.first.end());
+        u.insert(u.end(),im.second.begin(),im.second.end());
+        U.push_back(u);
+    }
+
+    vector<vector<pair<modsbig_t,modsbig_t>>> rationals(R*F);
+    bool done=false;
+
+    for (int k=1; k<modPrimesCount && !done; ++k) {
+        uint64_t p = modPrimes[k];
+        images_t next;
+
+        if (!solve(p,k+2,next)) return false;
+
+        for (int q=0; q<R*F; ++q) {
+            if (next[q].first.size() != images[q].first.size() || next[q].second.size() != images[q].second.size()) {
+                cout << "modular solve: inconsistent degrees. solving symbolically." << endl;
+                return false;
+            }
+        }
+
+        done = true;
+
+        for (int q=0; q<R*F && done; ++q) {
+            size_t nn = next[q].first.size();
+
+            rationals[q].resize(U[q].size());
+
+            for (size_t c=0; c<U[q].size() && done; ++c) {
+                uint64_t v = c < nn ? next[q].first[c] : next[q].second[c-nn];
+                modsbig_t a,b;
+
+                done = modRatReconstruct(U[q][c],M,a,b) && modReduce(a,p) == v*modReduce(b,p) % p;
+                rationals[q][c] = {a,b};
+            }
+        }
+
+        if (done) break;
+
+        if (k == 4) {
+            cout << "modular solve: coefficients exceed four primes. solving symbolically." << endl;
+            return false;
+        }
+
+        for (int q=0; q<R*F; ++q) {
+            size_t nn = next[q].first.size();
+
+            for (size_t c=0; c<U[q].size(); ++c) {
+                U[q][c] = modCRT(U[q][c],M,c < nn ? next[q].first[c] : next[q].second[c-nn],p);
+            }
+        }
+
+        M *= p;
+    }
+
+    if (!done) return false;
+
+    auto poly = [](const vector<pair<modsbig_t,modsbig_t>> &c, size_t from, size_t to) {
         stringstream strm;
-        strm << "system is singular at mu=" << mu << ".";
-        throw invalid_argument(strm.str());
+
+        for (size_t i=from; i<to; ++i) {
+            if (c[i].first == 0) continue;
+            if (!strm.str().empty()) strm << "+";
+            strm << "(" << modBigStr(c[i].first) << "/" << modBigStr(c[i].second) << ")";
+            if (i > from) strm << "*ep^" << i-from;
+        }
+
+        return strm.str().empty() ? string("0") : strm.str();
+    };
+
+    cout << "modular solve: " << F << " solutions with " << R*F << " entries, " << npoints << " points per prime." << endl;
+
+    basis.clear();
+
+    for (int f=0; f<F; ++f) {
+        vector<vector<string>> B(N,vector<string>(N,"0"));
+
+        B[freecols[f]/N][freecols[f]%N] = "1";
+
+        for (int r=0; r<R; ++r) {
+            auto &c = rationals[r*F+f];
+            size_t nn = images[r*F+f].first.size();
+
+            if (nn == 0) continue;
+
+            B[pivots[r]/N][pivots[r]%N] = "-(" + poly(c,0,nn) + ")/(" + poly(c,nn,c.size()) + ")";
+        }
+
+        stringstream strm;
+        strm << "{";
+        for (int i=0; i<N; ++i) {
+            strm << (i?",":"") << "{";
+            for (int j=0; j<N; ++j) {
+                strm << (j?",":"") << B[i][j];
+            }
+            strm << "}";
+        }
+        strm << "}";
+
+        basis.push_back(FermatArray(fermat,strm.str()));
     }
 
-    rk = echelon->run();
- 
-    FermatArray T(fermat,N,N);
-    T.assign("0");
+    return true;
+}
+
+bool System::factorepStructured(const residues_t &residues, const FermatExpression &mu, vector<FermatArray> &basis, bool &singular) {
+    FermatExpression ep(fermat,"ep");
+    int N = nullMatrix.C.rows();
+    bool symbolic = (mu.str() == "mu");
+    long m = symbolic ? 0 : stol(mu.str());
+
+    singular = false;
+
+    // eigenvalue a of A(ep)/ep coincides with eigenvalue b of A(mu)/mu
+    auto match = [&](const eigen_t &a, const eigen_t &b) {
+        if (a.u != 0) return false;
+        if (symbolic) return b.u == 0 && a.v == b.v;
+        return a.v*m == b.u + b.v*m;
+    };
+
+    try {
+        residues_t::const_iterator x0 = residues.end();
+        long best = -1;
+
+        // the number of parameters is bounded by the eigenvalue multiplicities
+        for (auto it = residues.begin(); it != residues.end(); ++it) {
+            if (singularities.at(it->first).rankC != 0) return false;
+
+            eigen(it->first);
+
+            long bound = 0;
+            for (auto &a : eigenvalues[it->first]) {
+                for (auto &b : eigenvalues[it->first]) {
+                    if (match(a.first,b.first)) bound += (long)a.second*b.second;
+                }
+            }
+
+            if (best < 0 || bound < best) {
+                best = bound;
+                x0 = it;
+            }
+        }
+
+        if (best <= 0) return false;
+
+        jordan(x0->first);
+
+        typedef struct {
+            int col;
+            int size;
+            eigen_t ev;
+        } block_t;
+
+        vector<block_t> blocks;
+        FermatArray P(fermat,N,N);
+        int col=1;
+        int smax=0;
+
+        for (auto &b : jordans[x0->first]) {
+            blocks.push_back({col,(int)b.rootvectors.size(),b.ev});
+            smax = max(smax,(int)b.rootvectors.size());
+
+            for (auto &v : b.rootvectors) {
+                P.setColumn(col++,v);
+            }
+        }
+
+        if (col != N+1) return false;
+
+        FermatArray Qinv = P.subst("ep",mu);
+
+        if (Qinv.det().str() == "0") return false;
+
+        Qinv = Qinv.inverse();
+
+        // in the jordan basis A(ep)/ep X = X A(mu)/mu decouples into block pairs. after rescaling
+        // X = diag(ep^(i-1)) Y diag(mu^(1-j)) each Y commutes with the shift, i.e. it is upper triangular toeplitz.
+        vector<FermatExpression> epPow(1,FermatExpression(fermat,1));
+        vector<FermatExpression> muPow(1,FermatExpression(fermat,1));
+
+        for (int i=1; i<smax; ++i) {
+            epPow.push_back(epPow.back()*ep);
+            muPow.push_back(muPow.back()/mu);
+        }
+
+        vector<FermatArray> Tk;
+
+        for (auto &a : blocks) {
+            FermatArray Pa(P,1,N,a.col,a.col+a.size-1);
+
+            for (auto &b : blocks) {
+                if (!match(a.ev,b.ev)) continue;
+
+                FermatArray Qb(Qinv,b.col,b.col+b.size-1,1,N);
+
+                for (int d=max(0,b.size-a.size); d<b.size; ++d) {
+                    FermatArray X(fermat,a.size,b.size);
+                    X.assign("0");
+
+                    for (int i=1; i<=a.size && i+d<=b.size; ++i) {
+                        X.set(i,i+d,epPow[i-1]*muPow[i+d-1]);
+                    }
+
+                    Tk.push_back(Pa*X*Qb);
+                }
+            }
+        }
+
+        int n = Tk.size();
+
+        cout << "structured solver: " << n << " parameters from x=" << x0->first.str() << "." << endl;
+
+        // impose the remaining singularities on the parameters
+        int rk = 0;
+        FermatArray M(fermat);
+
+        if (residues.size() > 1) {
+            M = FermatArray(fermat,N*N*(residues.size()-1),n);
+
+            int o=0;
+            for (auto it = residues.begin(); it != residues.end(); ++it) {
+                if (it == x0) continue;
+
+                for (int k=0; k<n; ++k) {
+                    FermatArray R = it->second.first*Tk[k]/ep - Tk[k]*it->second.second/mu;
+                    stringstream strm;
+
+                    strm << "Flatten([" << R.name() << "],[" << M.name() << "]," << k+1 << "," << o << ")";
+                    (*fermat)(strm.str());
+                }
+
+                o += N*N;
+            }
+
+            rk = M.rowEchelon();
+        }
+
+        if (rk == n) {
+            singular = true;
+            return false;
+        }
+
+        vector<int> pivots;
+        set<int> pivotset;
+
+        for (int r=1; r<=rk; ++r) {
+            int c=1;
+            while (M(r,c).str() == "0") ++c;
+
+            pivots.push_back(c);
+            pivotset.insert(c);
+        }
+
+        // one direction per free parameter, the pivot parameters are expressed through it
+        basis.clear();
+
+        for (int k=1; k<=n; ++k) {
+            if (pivotset.count(k)) continue;
+
+            FermatArray B = Tk[k-1];
+
+            for (int r=1; r<=rk && pivots[r-1] < k; ++r) {
+                FermatExpression e = M(r,k);
+                if (e.str() == "0") continue;
+
+                B -= Tk[pivots[r-1]-1]*(e/M(r,pivots[r-1]));
+            }
+
+            basis.push_back(B);
+        }
+    } catch (const exception &e) {
+        cout << "WARNING: structured solver failed (" << e.what() << "). solving the full system." << endl;
+        return false;
+    }
 
-    int pos=0;
+    return true;
+}
+
+vector<FermatArray> System::factorepSolution(EchelonBase *echelon) {
+    int N = nullMatrix.C.rows();
+    map<int,FermatArray> params;
 
     #define rpos(p) (((p)-1)/N+1)
     #define cpos(p) ((((p)-1)%N)+1)
 
-    for (auto &r : *echelon) {
-        for (int c=pos+1; c<r.col1(); ++c) {
-            stringstream strm;
-            string sym;
-
-            strm << "t" << rpos(c) << "x" << cpos(c);
-            sym = strm.str();
+    // direction of the free parameter at position c
+    auto param = [&](int c) -> FermatArray& {
+        if (!params.count(c)) {
+            FermatArray B(fermat,N,N);
+            B.assign("0");
+            B.set(rpos(c),cpos(c),FermatExpression(fermat,1));
+            params.insert({c,B});
+        }
+        return params.at(c);
+    };
 
-            if (!symbols.count(sym)) {
-                fermat->addSymbol(sym);
-                symbols.insert(sym);
-                cout << "adding symbol " << sym << "." << endl;
-            }
+    int pos=0;
 
-            T.set(rpos(c),cpos(c),FermatExpression(fermat,sym));
+    for (auto &r : *echelon) {
+        for (int c=pos+1; c<r.pivot(); ++c) {
+            param(c);
         }
        
-        pos = r.col1();
+        pos = r.pivot();
  
         for (auto &e : r) {
             if (e.first == pos) {
@@ -822,68 +1529,150 @@ void System::factorep(int mu) {
                 }
                 continue;
             }
-            
-            stringstream strm;
-            string sym;
-               
-            strm << "t" << rpos(e.first) << "x" << cpos(e.first);
-            sym = strm.str();
-            
-            if (!symbols.count(sym)) {
-                fermat->addSymbol(sym);
-                symbols.insert(sym);
-                cout << "adding symbol " << sym << "." << endl;
-            }
 
-            T.set(rpos(pos),cpos(pos),T(rpos(pos),cpos(pos))-e.second*FermatExpression(fermat,sym));
+            param(e.first).set(rpos(pos),cpos(pos),-e.second);
         }
     }
 
     for (int c=pos+1; c<=N*N; ++c) {
-        stringstream strm;
-        string sym;
+        param(c);
+    }
+
+    #undef rpos
+    #undef cpos
 
-        strm << "t" << rpos(c) << "x" << cpos(c);
-        sym = strm.str();
+    vector<FermatArray> basis;
+    for (auto &p : params) {
+        basis.push_back(p.second);
+    }
 
-        if (!symbols.count(sym)) {
-            fermat->addSymbol(sym);
-            symbols.insert(sym);
-            cout << "adding symbol " << sym << "." << endl;
-        }
+    return basis;
+}
+
+FermatArray System::factorepChoose(const vector<FermatArray> &basis, const FermatExpression &mu, int &mu0) {
+    int N = nullMatrix.C.rows();
+    int F = basis.size();
+    bool symbolic = (mu.str() == "mu");
+    vector<ModArray> mbasis;
+    set<string> syms;
 
-        T.set(rpos(c),cpos(c),FermatExpression(fermat,sym));
+    if (F == 0) {
+        throw invalid_argument("transformation is singular.");
     }
-    
-    #undef rpos
-    #undef cpos
 
-    delete echelon;
+    syms.insert("ep");
 
-    FermatExpression det = T.det();
+    for (auto &b : basis) {
+        mbasis.push_back(ModArray(b));
+        mbasis.back().symbols(syms);
+    }
+
+    typedef vector<vector<uint64_t>> modmatrix_t;
+
+    uint64_t p=0;
+    modvalues_t values;
+    vector<uint64_t> r(F);
+    vector<modmatrix_t> B(F);
+    modmatrix_t S;
+
+    auto evaluate = [&]() {
+        S.assign(N,vector<uint64_t>(N,0));
+
+        for (int f=0; f<F; ++f) {
+            B[f] = mbasis[f].eval(values,p);
+
+            for (int i=0; i<N; ++i) {
+                for (int j=0; j<N; ++j) {
+                    S[i][j] = (S[i][j] + r[f]*B[f][i][j]) % p;
+                }
+            }
+        }
+    };
+
+    auto modint = [&](int v) -> uint64_t {
+        return v < 0 ? p - ((uint64_t)(-(long)v) % p) : (uint64_t)v % p;
+    };
+
+    // find a point where T = sum r_f B_f is regular. the determinant is then
+    // known to be a nonzero polynomial, and it stays one if every parameter is
+    // fixed to a value which keeps it nonzero at this point.
+    bool regular=false;
+
+    for (int s=0; s<modPrimesCount && !regular; ++s) {
+        p = modPrimes[s];
+        values = modRandomValues(syms,p,s+1);
+
+        mt19937_64 gen(s+1);
+        for (auto &rf : r) rf = gen() % p;
+
+        try {
+            evaluate();
+            regular = (modDet(S,p) != 0);
+        } catch (const ModDivByZero &e) {
+        }
+    }
 
-    if (det.str() == "0") {
+    if (!regular) {
         throw invalid_argument("transformation is singular.");
     }
-   
-    for (auto it=symbols.begin(); it != symbols.end(); ++it) {
-        for (int _sym0=0; _sym0 <= 200; ++_sym0) {
-            int sym0 = ((_sym0&1)?1:-1)*((_sym0+1)>>1);
+
+    mu0 = 0;
+
+    if (symbolic) {
+        for (int _mu0=0;; ++_mu0) {
+            mu0 = ((_mu0&1)?1:-1)*((_mu0+1)>>1);
+            values["mu"] = modint(mu0);
+
             try {
-                FermatExpression det0 = det.subst(*it,sym0);
-                if (det0.str() != "0") {
-                    cout << *it << " -> " << sym0 << endl;
-                    det = det0;
-                    T = T.subst(*it,sym0);
-                    fermat->dropSymbol(*it);
-                    break;
+                evaluate();
+                if (modDet(S,p) != 0) break;
+            } catch (const ModDivByZero &e) {
+            }
+        }
+
+        cout << "mu -> " << mu0 << endl;
+    }
+
+    vector<int> s0(F);
+
+    for (int f=0; f<F; ++f) {
+        for (int i=0; i<N; ++i) {
+            for (int j=0; j<N; ++j) {
+                S[i][j] = (S[i][j] + (p-r[f])*B[f][i][j]) % p;
+            }
+        }
+
+        for (int _s=0;; ++_s) {
+            s0[f] = ((_s&1)?1:-1)*((_s+1)>>1);
+            uint64_t v = modint(s0[f]);
+
+            modmatrix_t T = S;
+            for (int i=0; i<N; ++i) {
+                for (int j=0; j<N; ++j) {
+                    T[i][j] = (T[i][j] + v*B[f][i][j]) % p;
                 }
-            } catch (const FermatDivByZero &e) {
+            }
+
+            if (modDet(T,p) != 0) {
+                S = T;
+                break;
             }
         }
     }
 
-    transform(T);
+    FermatArray T(fermat,N,N);
+    T.assign("0");
+
+    int nonzero=0;
+    for (int f=0; f<F; ++f) {
+        if (!s0[f]) continue;
+        T += basis[f]*s0[f];
+        ++nonzero;
+    }
+
+    cout << nonzero << " of " << F << " free parameters set to nonzero values." << endl;
+
+    return T;
 }
 
 void System::leftranks() {
@@ -898,6 +1687,10 @@ void System::leftranks() {
 }
 
 int System::leftreduce(const FermatExpression &xj) {
+    return leftreduce(xj,NULL);
+}
+
+int System::leftreduce(const FermatExpression &xj, const leftsolution_t *prepared) {
     int k;
     for (k=singularities.at(xj).rank; k>=0 && A(xj,k).B.isZero(); --k);
 
@@ -908,14 +1701,64 @@ int System::leftreduce(const FermatExpression &xj) {
 
     FermatArray B = A(xj,k).B;
     TriangleBlockMatrix A0 = A(xj,0);
+    FermatArray G;
+
+    // a solution prepared in a worker session is usable if B did not change since
+    if (prepared && prepared->k == k && (B - prepared->B).isZero()) {
+        cout << "using prepared solution." << endl;
+        G = FermatArray(fermat,prepared->G);
+    } else {
+        try {
+            if (!sylvesters.count(xj)) {
+                sylvesters[xj] = Sylvester(A0.C,A0.A);
+            }
+
+            G = sylvesters.at(xj).solve(k,-B);
+        } catch (const exception &e) {
+            cout << "WARNING: structured solver failed (" << e.what() << "). solving the full system." << endl;
+            sylvesters.erase(xj);
+
+            G = leftreduceSolve(B,A0,k);
+        }
+    }
+
+    lefttransform(G,xj,k);
+
+    if (!A(xj,k).B.isZero()) {
+        throw invalid_argument("transformation failed.");
+    }
 
-    EchelonBase *echelon;
+    for (--k; k>=0 && A(xj,k).B.isZero(); --k);
+
+    cout << "new rank:\t" << pstr(xj) <<":" << k << endl;
+
+    return k;
+}
 
-    if (echfer) {
-        echelon = new EchelonFermat(fermat,B.rows()*B.cols(),B.rows()*B.cols()+2);
+// rows and cols size the array of EchelonFermat, columns beyond unknowns are right hand sides
+EchelonBase *System::newEchelon(int rows, int cols, int unknowns) const {
+    if (options.echfer) {
+        return new EchelonFermat(fermat,rows,cols);
+    } else if (options.echauto) {
+        EchelonAuto *ech = new EchelonAuto(fermat);
+        if (session) ech->setWorkers(session,options.threads);
+        if (options.markowitz) ech->setMarkowitz(unknowns);
+        ech->setSpill(options.spill);
+        return ech;
+    } else if (options.markowitz) {
+        EchelonMarkowitz *ech = new EchelonMarkowitz(fermat,unknowns);
+        ech->setSpill(options.spill);
+        return ech;
     } else {
-        echelon = new Echelon(fermat);
+        Echelon *ech = new Echelon(fermat);
+        if (session) ech->setWorkers(session,options.threads);
+        ech->setSpill(options.spill);
+        return ech;
     }
+}
+
+FermatArray System::leftreduceSolve(const FermatArray &B, const TriangleBlockMatrix &A0, int k) {
+    EchelonBase *echelon = newEchelon(B.rows()*B.cols(),B.rows()*B.cols()+2,B.rows()*B.cols());
 
     #define pos(i,j) (((i)-1)*B.cols()+(j))
 
@@ -954,7 +1797,7 @@ int System::leftreduce(const FermatExpression &xj) {
 
     for (auto &r : *echelon) {
         auto it = r.begin();
-        int pos = it->first;
+        int pos = r.pivot();
 
         if (pos == B.rows()*B.cols()+1) {
             throw invalid_argument("linear system has no solution.");
@@ -976,21 +1819,16 @@ int System::leftreduce(const FermatExpression &xj) {
 
     delete echelon;
 
-    lefttransform(G,xj,k);
-
-    if (!A(xj,k).B.isZero()) {
-        throw invalid_argument("transformation failed.");
-    }
-
-    for (--k; k>=0 && A(xj,k).B.isZero(); --k);
-
-    cout << "new rank:\t" << pstr(xj) <<":" << k << endl;
-
-    return k;
+    return G;
 }
 
 void System::leftfuchsify() {
     auto sings = singularities;
+    map<FermatExpression,leftsolution_t> prepared;
+
+    if (options.threads > 1 && session) {
+        leftprepare(prepared);
+    }
 
     for (auto &s : sings) {
         FermatExpression xj = s.first;
@@ -1001,11 +1839,66 @@ void System::leftfuchsify() {
         if (k>=0) cout << "rank:    \t" << pstr(xj) << ":" << k << endl;
 
         while (k>0) {
-            k = leftreduce(xj);
+            if (prepared.count(xj)) {
+                k = leftreduce(xj,&prepared.at(xj));
+                prepared.erase(xj);
+            } else {
+                k = leftreduce(xj);
+            }
         }            
     }
 }
 
+void System::leftprepare(map<FermatExpression,leftsolution_t> &prepared) {
+    typedef struct {
+        FermatExpression xj;
+        int k;
+        string B,C,A;
+        string G;
+        bool done;
+    } job_t;
+
+    vector<job_t> jobs;
+
+    for (auto &s : singularities) {
+        FermatExpression xj = s.first;
+        int k;
+
+        for (k=s.second.rank; k>=0 && A(xj,k).B.isZero(); --k);
+
+        if (k<=0) continue;
+
+        TriangleBlockMatrix A0 = A(xj,0);
+
+        jobs.push_back({xj,k,A(xj,k).B.str(),A0.C.str(),A0.A.str(),"",false});
+    }
+
+    if (jobs.size() < 2) return;
+
+    int nthreads = min((int)jobs.size(),options.threads);
+
+    cout << "preparing " << jobs.size() << " left reductions in " << nthreads << " sessions." << endl;
+
+    // the workers only see strings, the main session is not touched until all of them are joined.
+    // jobs of a failed worker stay undone and are reduced serially.
+    session->workers().run(nthreads,jobs.size(),[&](Fermat *worker, size_t i, size_t) {
+        FermatArray B(worker,jobs[i].B);
+        FermatArray C(worker,jobs[i].C);
+        FermatArray A(worker,jobs[i].A);
+
+        Sylvester sylvester(C,A);
+
+        jobs[i].G = sylvester.solve(jobs[i].k,-B).str();
+        jobs[i].done = true;
+    });
+
+    for (auto &job : jobs) {
+        if (!job.done) continue;
+
+        prepared[job.xj] = {job.k,FermatArray(fermat,job.B),job.G};
+    }
+}
+
 bool System::projectorQ(const FermatExpression &x1, const FermatExpression &x2, FermatArray &Q) {
     list<JordanBlock> inv;
     int i,k,k0;
@@ -1343,12 +2236,135 @@ void System::balance(const FermatArray &P, const FermatExpression &x1, const Fer
     }
 
     jordans.clear();
+    sylvesters.clear();
     eigenvalues.erase(x1);
     eigenvalues.erase(x2);
 
     updatePoincareRanks();
 
+    monitor("balance ["+pstr(x1)+","+pstr(x2)+"]");
+
     tqueue.balance(P,x1,x2);
+
+    transformed();
+}
+
+void System::simplify() {
+    int N = nullMatrix.C.rows();
+    vector<FermatArray> arrays;
+
+    ntrans = 0;
+    if (N == 0) return;
+
+    for (auto &a : _A) {
+        arrays.insert(arrays.end(),{a.second.B,a.second.C,a.second.E});
+    }
+    for (auto &b : _B) {
+        arrays.insert(arrays.end(),{b.second.B,b.second.C,b.second.E});
+    }
+
+    // gcd of numerators and denominators of every row (rc) and column (cc) of the active block
+    FermatArray rc(fermat,N,2);
+    FermatArray cc(fermat,N,2);
+
+    rc.assign("0");
+    cc.assign("0");
+
+    for (size_t n=0; n<arrays.size(); n+=3) {
+        if (arrays[n].cols() > 0) {
+            (*fermat)("Content(["+arrays[n].name()+"],["+rc.name()+"])");
+        }
+        (*fermat)("Content(["+arrays[n+1].name()+"],["+rc.name()+"])");
+        (*fermat)("Content(["+arrays[n+1].transpose().name()+"],["+cc.name()+"])");
+        if (arrays[n+2].rows() > 0) {
+            (*fermat)("Content(["+arrays[n+2].transpose().name()+"],["+cc.name()+"])");
+        }
+    }
+
+    // candidates: divide out the row contents or the column contents
+    vector<FermatArray> candidates;
+    FermatArray Trow(fermat,N,N);
+    FermatArray Tcol(fermat,N,N);
+    bool rowtrivial=true,coltrivial=true;
+
+    Trow.assign("[1] + 0");
+    Tcol.assign("[1] + 0");
+
+    for (int i=1; i<=N; ++i) {
+        if (rc(i,1).str() != "0") {
+            FermatExpression c = rc(i,1)/rc(i,2);
+            if (c.str() != "1") {
+                Trow.set(i,i,c);
+                rowtrivial = false;
+            }
+        }
+
+        if (cc(i,1).str() != "0") {
+            FermatExpression k = cc(i,2)/cc(i,1);
+            if (k.str() != "1") {
+                Tcol.set(i,i,k);
+                coltrivial = false;
+            }
+        }
+    }
+
+    if (!rowtrivial) candidates.push_back(Trow);
+    if (!coltrivial) candidates.push_back(Tcol);
+
+    SizeMonitor::sizes_t sizes = SizeMonitor::measure(arrays);
+    long terms = sizes.terms;
+    FermatArray T;
+    vector<FermatArray> best;
+
+    for (auto &T0 : candidates) {
+        FermatArray Tinv = T0.inverse();
+        vector<FermatArray> arrays0;
+
+        for (size_t n=0; n<arrays.size(); n+=3) {
+            arrays0.push_back(Tinv * arrays[n]);
+            arrays0.push_back(Tinv * arrays[n+1] * T0);
+            arrays0.push_back(arrays[n+2] * T0);
+        }
+
+        SizeMonitor::sizes_t sizes0 = SizeMonitor::measure(arrays0);
+
+        if (sizes0.terms < terms) {
+            terms = sizes0.terms;
+            T = T0;
+            best = arrays0;
+        }
+    }
+
+    cout << "simplification: " << sizes.terms << " -> " << terms << " terms." << endl;
+
+    if (best.empty()) return;
+
+    auto bit = best.begin();
+
+    for (auto it = _A.begin(); it != _A.end(); ++it) {
+        it->second.B = *(bit++);
+        it->second.C = *(bit++);
+        it->second.E = *(bit++);
+    }
+    for (auto it = _B.begin(); it != _B.end(); ++it) {
+        it->second.B = *(bit++);
+        it->second.C = *(bit++);
+        it->second.E = *(bit++);
+    }
+
+    jordans.clear();
+    sylvesters.clear();
+
+    monitor("simplification");
+
+    tqueue.transform(T);
+}
+
+void System::transformed() {
+    if (options.simplify <= 0 || tqueue.isReplaying()) return;
+    if (++ntrans < options.simplify) return;
+
+    simplify();
 }
 
 void System::balance_x1_x2(const FermatArray &P, const FermatExpression &x1, const FermatExpression &x2) {
@@ -1775,8 +2791,16 @@ void System::transform(const FermatArray &T) {
         it->second.C = Tinv * it->second.C * T;
         it->second.E = it->second.E * T;
     }
+
+    // eigenvalues are invariant, the root vectors are not
+    jordans.clear();
+    sylvesters.clear();
     
+    monitor("transformation");
+
     tqueue.transform(T);
+
+    transformed();
 }
 
 void System::lefttransform(const FermatArray &G, const FermatExpression &x1, int k) {
@@ -1803,6 +2827,25 @@ void System::lefttransform(const FermatArray &G, const FermatExpression &x1, int
         return;
     }
 
+    // the E blocks and the residues are not touched below, every product is formed once.
+    map<FermatExpression,FermatArray> S;
+    map<sing_t,FermatArray> AEG;
+    map<int,FermatArray> BEG;
+
+    auto commutator = [&](const FermatExpression &xj) -> const FermatArray& {
+        if (!S.count(xj)) S[xj] = A(xj,0).C*G - G*A(xj,0).A;
+        return S.at(xj);
+    };
+    auto aeg = [&](const FermatExpression &xj, int n) -> const FermatArray& {
+        sing_t s = {xj,n};
+        if (!AEG.count(s)) AEG[s] = A(xj,n).E*G;
+        return AEG.at(s);
+    };
+    auto beg = [&](int n) -> const FermatArray& {
+        if (!BEG.count(n)) BEG[n] = B(n).E*G;
+        return BEG.at(n);
+    };
+
     //B
     sing.point = x1;
     sing.rank = k;
@@ -1817,7 +2860,7 @@ void System::lefttransform(const FermatArray &G, const FermatExpression &x1, int
             FermatExpression xj = it->first;
             if (xj == x1 || xj == infinity) continue;
 
-            _A[sing].B -= (A(xj,0).C*G - G*A(xj,0).A)/pow(xj-x1,k-n);
+            _A[sing].B -= commutator(xj)/pow(xj-x1,k-n);
         }
     }
         
@@ -1828,7 +2871,7 @@ void System::lefttransform(const FermatArray &G, const FermatExpression &x1, int
         sing.point = xj;
         sing.rank = 0;
 
-        _A[sing].B += (A(xj,0).C*G - G*A(xj,0).A)/pow(xj-x1,k);
+        _A[sing].B += commutator(xj)/pow(xj-x1,k);
     }
 
     //D
@@ -1843,10 +2886,20 @@ void System::lefttransform(const FermatArray &G, const FermatExpression &x1, int
 
             if (xj == x1) continue;
 
-            _A[sing].D -= it->second.E*G*powi(-1,i)*binomi(k+i-n-1,i)/pow(xj-x1,k+i-n);
+            _A[sing].D -= aeg(xj,i)*powi(-1,i)*binomi(k+i-n-1,i)/pow(xj-x1,k+i-n);
         }
-        for (int i=0; i+k-n-1 <= kmax; ++i) {
-            _A[sing].D += B(i+k-n-1).E*G*pow(x1,i)*binomi(i+k-n-1,i);
+
+        // sum_i B(i+k-n-1).E*G*x1^i*binomi(i+k-n-1,i) by horner's rule
+        int imax = kmax-(k-n-1);
+
+        if (imax >= 0) {
+            FermatArray acc = beg(imax+k-n-1)*binomi(imax+k-n-1,imax);
+
+            for (int i=imax-1; i>=0; --i) {
+                acc = acc*x1 + beg(i+k-n-1)*binomi(i+k-n-1,i);
+            }
+
+            _A[sing].D += acc;
         }
     }
 
@@ -1874,29 +2927,71 @@ void System::lefttransform(const FermatArray &G, const FermatExpression &x1, int
 
         if (xj == x1) continue;
 
-        for (int i=0; n+i <= singularities[xj].rank; ++i) {
-            it->second.D += A(xj,n+i).E*G*binomi(k+i-1,i)*powi(-1,k)/pow(x1-xj,k+i);
+        // (-1)^k/(x1-xj)^k * sum_i A(xj,n+i).E*G*binomi(k+i-1,i)/(x1-xj)^i by horner's rule
+        int imax = singularities[xj].rank-n;
+
+        if (imax < 0) continue;
+
+        FermatArray acc = aeg(xj,n+imax)*binomi(k+imax-1,imax);
+
+        for (int i=imax-1; i>=0; --i) {
+            acc = acc/(x1-xj) + aeg(xj,n+i)*binomi(k+i-1,i);
         }
+
+        it->second.D += acc*powi(-1,k)/pow(x1-xj,k);
     }
 
     for (auto it = _B.begin(); it != _B.end(); ++it) {
         int n = it->first;
 
-        for (int m=0; n+m+k <= kmax; ++m) {
-            for (int i=0; i+n+m+k <= kmax; ++i) {
-                it->second.D += B(i+n+m+k).E*G*powi(-1,m)*pow(x1,m+i)*binomi(n+m,n)*binomi(i+n+m+k,i);
+        // sum_m sum_i B(L).E*G*(-1)^m*x1^(m+i)*binomi(n+m,n)*binomi(L,i) with L=i+n+m+k
+        // collapses to sum_L B(L).E*G*x1^(L-n-k)*c(L), evaluated by horner's rule.
+        if (n+k > kmax) continue;
+
+        FermatArray acc;
+
+        for (int L=kmax; L>=n+k; --L) {
+            stringstream strm;
+
+            strm << "0";
+            for (int m=0; m<=L-n-k; ++m) {
+                strm << ((m&1)?"-":"+") << "Bin(" << n+m << "," << n << ")*Bin(" << L << "," << L-n-m-k << ")";
             }
+
+            FermatArray term = beg(L)*FermatExpression(fermat,strm.str());
+
+            acc = (L == kmax) ? term : acc*x1 + term;
         }
+
+        it->second.D += acc;
     }
 
     updatePoincareRanks();
+
+    monitor("left transformation ["+pstr(x1)+","+to_string(k)+"]");
     
     tqueue.lefttransform(G,x1,k);
+
+    transformed();
 }
 
 void System::lefttransform_inf(const FermatArray &G, int k) {
     sing_t sing;
 
+    // the E blocks and the residues are not touched below, every product is formed once.
+    map<FermatExpression,FermatArray> S;
+    map<sing_t,FermatArray> AEG;
+
+    auto commutator = [&](const FermatExpression &xj) -> const FermatArray& {
+        if (!S.count(xj)) S[xj] = A(xj,0).C*G - G*A(xj,0).A;
+        return S.at(xj);
+    };
+    auto aeg = [&](const FermatExpression &xj, int n) -> const FermatArray& {
+        sing_t s = {xj,n};
+        if (!AEG.count(s)) AEG[s] = A(xj,n).E*G;
+        return AEG.at(s);
+    };
+
     //B
     _B[k-1].B -= G*k;
 
@@ -1905,7 +3000,7 @@ void System::lefttransform_inf(const FermatArray &G, int k) {
             FermatExpression xj = it->first;
             if (xj == infinity) continue;
 
-            _B[n].B += (A(xj,0).C*G - G*A(xj,0).A)*pow(xj,k-n-1);
+            _B[n].B += commutator(xj)*pow(xj,k-n-1);
         }
     }
 
@@ -1916,7 +3011,7 @@ void System::lefttransform_inf(const FermatArray &G, int k) {
         sing.point = xj;
         sing.rank = 0;
 
-        _A[sing].B += (A(xj,0).C*G - G*A(xj,0).A)*pow(xj,k);
+        _A[sing].B += commutator(xj)*pow(xj,k);
     }
 
     //D
@@ -1924,9 +3019,14 @@ void System::lefttransform_inf(const FermatArray &G, int k) {
         FermatExpression xj = it->first.point;
         int n = it->first.rank;
 
-        for (int i=0; i<=k; ++i) {
-            it->second.D += A(xj,n+k-i).E*G*pow(xj,i)*binomi(k,k-i);
+        // sum_i A(xj,n+k-i).E*G*xj^i*binomi(k,k-i) by horner's rule
+        FermatArray acc = aeg(xj,n)*binomi(k,0);
+
+        for (int i=k-1; i>=0; --i) {
+            acc = acc*xj + aeg(xj,n+k-i)*binomi(k,k-i);
         }
+
+        it->second.D += acc;
     }
 
     for (int n=0; n<k; ++n) {
@@ -1934,11 +3034,24 @@ void System::lefttransform_inf(const FermatArray &G, int k) {
             FermatExpression xj = it->first;
             if (xj == infinity) continue;
 
-            for (int m=0; m<=k-n-1; ++m) {
-                for (int i=0; i<=m; ++i) {
-                    _B[n].D += A(xj,i).E*G*powi(-1,k-n-m-1)*pow(xj,k-n-i-1)*binomi(k-m-1,n)*binomi(k,k+i-m);
+            // sum_m sum_(i<=m) A(xj,i).E*G*(-1)^(k-n-m-1)*xj^(k-n-i-1)*binomi(k-m-1,n)*binomi(k,k+i-m)
+            // collapses to sum_i A(xj,i).E*G*xj^(k-n-i-1)*c(i), evaluated by horner's rule.
+            FermatArray acc;
+
+            for (int i=0; i<=k-n-1; ++i) {
+                stringstream strm;
+
+                strm << "0";
+                for (int m=i; m<=k-n-1; ++m) {
+                    strm << (((k-n-m-1)&1)?"-":"+") << "Bin(" << k-m-1 << "," << n << ")*Bin(" << k << "," << k+i-m << ")";
                 }
+
+                FermatArray term = aeg(xj,i)*FermatExpression(fermat,strm.str());
+
+                acc = (i == 0) ? term : acc*xj + term;
             }
+
+            _B[n].D += acc;
         }
     }
 
@@ -1959,7 +3072,11 @@ void System::lefttransform_inf(const FermatArray &G, int k) {
 
     updatePoincareRanks();
 
+    monitor("left transformation [inf,"+to_string(k)+"]");
+
     tqueue.lefttransform(G,infinity,k);
+
+    transformed();
 }
 
 void System::lefttransformFull(const FermatArray &G, const FermatExpression &x1, int k) {
@@ -1974,16 +3091,41 @@ void System::lefttransformFull(const FermatArray &G, const FermatExpression &x1,
         return;
     }
 
+    // commutators are cached only as long as the block they are formed from is unchanged.
+    map<sing_t,FermatArray> AG;
+    map<int,FermatArray> BG;
+
+    auto acomm = [&](const FermatExpression &xj, int n) -> const FermatArray& {
+        sing_t s = {xj,n};
+        if (!AG.count(s)) AG[s] = A(xj,n).C*G - G*A(xj,n).C;
+        return AG.at(s);
+    };
+    auto bcomm = [&](int n) -> const FermatArray& {
+        if (!BG.count(n)) BG[n] = B(n).C*G - G*B(n).C;
+        return BG.at(n);
+    };
+
+    // every entry only reads entries of higher rank, which are still unchanged.
     for (auto it = _A.begin(); it != _A.end(); ++it) {
         FermatExpression xj = it->first.point;
         int n = it->first.rank;
         if (xj == x1) continue;
 
-        for (int i=0; n+i <= singularities[xj].rank; ++i) {
-            it->second.C += (A(xj,n+i).C*G - G*A(xj,n+i).C)*powi(-1,k)*binomi(k+i-1,i)/pow(x1-xj,k+i);
+        int imax = singularities[xj].rank-n;
+
+        if (imax < 0) continue;
+
+        FermatArray acc = acomm(xj,n+imax)*binomi(k+imax-1,imax);
+
+        for (int i=imax-1; i>=0; --i) {
+            acc = acc/(x1-xj) + acomm(xj,n+i)*binomi(k+i-1,i);
         }
+
+        it->second.C += acc*powi(-1,k)/pow(x1-xj,k);
     }
 
+    AG.clear();
+
     for (int n=0; n<k; ++n) {
         sing.point = x1;
         sing.rank = n;
@@ -1993,11 +3135,19 @@ void System::lefttransformFull(const FermatArray &G, const FermatExpression &x1,
             int i = it->first.rank;
             if (xj == x1) continue;
 
-            _A[sing].C += (it->second.C*G - G*it->second.C)*powi(-1,i+1)*binomi(k+i-n-1,i)/pow(xj-x1,k+i-n);
+            _A[sing].C += acomm(xj,i)*powi(-1,i+1)*binomi(k+i-n-1,i)/pow(xj-x1,k+i-n);
         }
 
-        for (int i=0; i+k-n-1<=kmax; ++i) {
-            _A[sing].C += (B(i+k-n-1).C*G - G*B(i+k-n-1).C)*pow(x1,i)*binomi(i+k-n-1,i);
+        int imax = kmax-(k-n-1);
+
+        if (imax >= 0) {
+            FermatArray acc = bcomm(imax+k-n-1)*binomi(imax+k-n-1,imax);
+
+            for (int i=imax-1; i>=0; --i) {
+                acc = acc*x1 + bcomm(i+k-n-1)*binomi(i+k-n-1,i);
+            }
+
+            _A[sing].C += acc;
         }
     }
 
@@ -2014,39 +3164,86 @@ void System::lefttransformFull(const FermatArray &G, const FermatExpression &x1,
         _A[sing].C += A(x1,n-k).C*G - G*A(x1,n-k).C;
     }
 
+    // _B[n] only reads B(L) with L>n, which are still unchanged.
     for (auto it=_B.begin(); it != _B.end(); ++it) {
         int n=it->first;
 
-        for (int m=0; n+m+k<=kmax; ++m) {
-            for (int i=0; i+n+m+k<=kmax; ++i) {
-                _B[n].C += (B(i+n+m+k).C*G - G*B(i+n+m+k).C)*powi(-1,m)*pow(x1,m+i)*binomi(n+m,n)*binomi(i+n+m+k,i);
+        if (n+k > kmax) continue;
+
+        FermatArray acc;
+
+        for (int L=kmax; L>=n+k; --L) {
+            stringstream strm;
+
+            strm << "0";
+            for (int m=0; m<=L-n-k; ++m) {
+                strm << ((m&1)?"-":"+") << "Bin(" << n+m << "," << n << ")*Bin(" << L << "," << L-n-m-k << ")";
             }
+
+            FermatArray term = bcomm(L)*FermatExpression(fermat,strm.str());
+
+            acc = (L == kmax) ? term : acc*x1 + term;
         }
+
+        _B[n].C += acc;
     }
 
     updatePoincareRanks();
+    monitor("left transformation ["+pstr(x1)+","+to_string(k)+"]");
 }
 
 void System::lefttransformFull_inf(const FermatArray &G, int k) {
+    // commutators are cached only as long as the block they are formed from is unchanged.
+    map<sing_t,FermatArray> AG;
+
+    auto acomm = [&](const FermatExpression &xj, int n) -> const FermatArray& {
+        sing_t s = {xj,n};
+        if (!AG.count(s)) AG[s] = A(xj,n).C*G - G*A(xj,n).C;
+        return AG.at(s);
+    };
+
+    // the terms i<k read entries of higher rank, which are still unchanged. the term i=k
+    // reads the entry itself after the other terms have been added.
     for (auto it = _A.begin(); it != _A.end(); ++it) {
         FermatExpression xj = it->first.point;
         int n = it->first.rank;
 
-        for (int i=0; i<=k; ++i) {
-            it->second.C += (A(xj,n+k-i).C*G - G*A(xj,n+k-i).C)*pow(xj,i)*binomi(k,k-i);
+        if (k > 0) {
+            FermatArray acc = acomm(xj,n+1)*binomi(k,1);
+
+            for (int i=k-2; i>=0; --i) {
+                acc = acc*xj + acomm(xj,n+k-i)*binomi(k,k-i);
+            }
+
+            it->second.C += acc;
         }
+
+        it->second.C += (it->second.C*G - G*it->second.C)*pow(xj,k)*binomi(k,0);
     }
 
+    AG.clear();
+
     for (int n=0; n<k-1; ++n) {
         for (auto it=singularities.begin(); it != singularities.end(); ++it) {
             FermatExpression xj = it->first;
             if (xj == infinity) continue;
 
-            for (int m=0; m<=k-n-1; ++m) {
-                for (int i=0; i<=m; ++i) {
-                    _B[n].C += (A(xj,i).C*G - G*A(xj,i).C)*powi(-1,k-n-m-1)*pow(xj,k-n-i-1)*binomi(k-m-1,n)*binomi(k,k+i-m);
+            FermatArray acc;
+
+            for (int i=0; i<=k-n-1; ++i) {
+                stringstream strm;
+
+                strm << "0";
+                for (int m=i; m<=k-n-1; ++m) {
+                    strm << (((k-n-m-1)&1)?"-":"+") << "Bin(" << k-m-1 << "," << n << ")*Bin(" << k << "," << k+i-m << ")";
                 }
+
+                FermatArray term = acomm(xj,i)*FermatExpression(fermat,strm.str());
+
+                acc = (i == 0) ? term : acc*xj + term;
             }
+
+            _B[n].C += acc;
         }
     }
 
@@ -2055,7 +3252,7 @@ void System::lefttransformFull_inf(const FermatArray &G, int k) {
         FermatExpression xj = it->first;
         if (xj == infinity) continue;
 
-        _B[k-1].C += A(xj,0).C*G - G*A(xj,0).C;
+        _B[k-1].C += acomm(xj,0);
     }
 
     for (int n=k; n-k<=kmax; ++n) {
@@ -2064,6 +3261,7 @@ void System::lefttransformFull_inf(const FermatArray &G, int k) {
     }
     
     updatePoincareRanks();
+    monitor("left transformation [inf,"+to_string(k)+"]");
 }
 
 void System::updatePoincareRanks() {
@@ -2128,6 +3326,21 @@ void System::updatePoincareRanks() {
     }
 }
 
+void System::monitor(const string &label) {
+    if (!sizemon) return;
+
+    vector<FermatArray> arrays;
+
+    for (auto &a : _A) {
+        arrays.insert(arrays.end(),{a.second.A,a.second.B,a.second.C,a.second.D,a.second.E,a.second.F});
+    }
+    for (auto &b : _B) {
+        arrays.insert(arrays.end(),{b.second.A,b.second.B,b.second.C,b.second.D,b.second.E,b.second.F});
+    }
+
+    sizemon->record(label,arrays);
+}
+
 FermatExpression System::regularPoint() {
     if (!singularities.count(infinity)) {
         return infinity;
@@ -22,15 +22,199 @@
 #include <TransformationQueue.h>
 #include <sstream>
 #include <iostream>
+#include <iomanip>
 #include <algorithm>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <unistd.h>
 #include <System.h>
+#include <Session.h>
 using namespace std;
 
+bool queueProduct = false;
+volatile sig_atomic_t queueSignal = 0;
+
+static const size_t maxPending = 64 << 20;
+static atomic<int> activeWriters(0);
+
+static uint32_t crc32(const string &str) {
+    static uint32_t table[256];
+    static bool init = false;
+
+    if (!init) {
+        for (uint32_t n=0; n<256; ++n) {
+            uint32_t c = n;
+            for (int k=0; k<8; ++k) {
+                c = c&1 ? 0xedb88320u^(c>>1) : c>>1;
+            }
+            table[n] = c;
+        }
+        init = true;
+    }
+
+    uint32_t crc = 0xffffffffu;
+
+    for (unsigned char ch : str) {
+        crc = table[(crc^ch)&0xff]^(crc>>8);
+    }
+
+    return crc^0xffffffffu;
+}
+
+/*
+ *  every line of a queue file is framed as <entry>;<crc32 of entry>. a line with a missing or wrong
+ *  checksum is a torn write and only tolerated at the end of the file.
+ */
+static string frame(const string &entry) {
+    stringstream strm;
+    strm << entry << ";" << hex << setw(8) << setfill('0') << crc32(entry);
+    return strm.str();
+}
+
+static bool unframe(string &line, bool &framed) {
+    size_t semicolon = line.rfind(';');
+
+    framed = semicolon != string::npos && line.size()-semicolon == 9;
+    if (!framed) return false;
+
+    string entry(line,0,semicolon);
+    char *end;
+    uint32_t crc = strtoul(line.c_str()+semicolon+1,&end,16);
+
+    if (*end || crc32(entry) != crc) return false;
+
+    line = entry;
+    return true;
+}
+
+static void signalHandler(int sig) {
+    if (sig != SIGUSR1 && activeWriters == 0) {
+        signal(sig,SIG_DFL);
+        raise(sig);
+        return;
+    }
+
+    queueSignal = sig;
+}
+
+/*
+ *  journal layout: the header "EPSJRNL1" followed by records
+ *      magic, length of label, length of matrix, label, matrix, state, crc32(label+matrix+state)
+ *  with little endian 32 bit integers. the label has the format of the text queue files.
+ */
+static const string journalMagic = "EPSJRNL1";
+static const uint32_t recordMagic = 0x4a524543;
+
+static void put32(string &str, uint32_t v) {
+    for (int i=0; i<4; ++i) {
+        str += (char)((v>>(8*i))&0xff);
+    }
+}
+
+static uint32_t get32(const char *p) {
+    uint32_t v = 0;
+    for (int i=3; i>=0; --i) {
+        v = (v<<8)|(unsigned char)p[i];
+    }
+    return v;
+}
+
+static bool isJournal(const string &filename) {
+    ifstream in(filename,ios::binary);
+    string magic(journalMagic.size(),' ');
+
+    return in.read(&magic[0],magic.size()) && magic == journalMagic;
+}
+
+static bool readRecord(ifstream &in, streamoff pos, streamoff size, string &label, string *matrix, uint32_t &state, streamoff &end) {
+    char buf[12];
+
+    in.clear();
+    in.seekg(pos);
+
+    if (pos+12 > size || !in.read(buf,12) || get32(buf) != recordMagic) return false;
+
+    uint32_t llen = get32(buf+4);
+    uint32_t mlen = get32(buf+8);
+
+    end = pos+12+llen+mlen+8;
+    if (end > size) return false;
+
+    label.resize(llen);
+    in.read(&label[0],llen);
+
+    if (matrix) {
+        matrix->resize(mlen);
+        in.read(&(*matrix)[0],mlen);
+    } else {
+        in.seekg(mlen,ios::cur);
+    }
+
+    if (!in.read(buf,8)) return false;
+    state = get32(buf);
+
+    if (matrix && crc32(label + *matrix + string(buf,4)) != get32(buf+4)) return false;
+
+    return true;
+}
+
+/*
+ *  offsets of the complete records of a journal. the index is trusted as far as it is consistent with the
+ *  journal, the rest is found by scanning the record headers. with verify all checksums are checked.
+ */
+static vector<streamoff> journalRecords(const string &filename, bool verify, streamoff &end) {
+    ifstream in(filename,ios::binary|ios::ate);
+    ifstream idx(filename+".idx",ios::binary);
+    vector<streamoff> offsets;
+    streamoff size = in.tellg();
+    string label, matrix;
+    uint32_t state;
+    char buf[8];
+
+    if (!isJournal(filename)) {
+        throw invalid_argument(filename + " is not a journal.");
+    }
+
+    end = journalMagic.size();
+
+    while (idx.read(buf,8)) {
+        streamoff pos = get32(buf) | (streamoff)get32(buf+4)<<32;
+        streamoff next;
+
+        if (pos != end || !readRecord(in,pos,size,label,verify?&matrix:NULL,state,next)) break;
+
+        offsets.push_back(pos);
+        end = next;
+    }
+
+    for (streamoff next; readRecord(in,end,size,label,verify?&matrix:NULL,state,next); end = next) {
+        offsets.push_back(end);
+    }
+
+    if (end != size) {
+        cout << "ignoring incomplete last record of " << filename << "." << endl;
+    }
+
+    return offsets;
+}
+
 TransformationQueue::TransformationQueue(const TransformationQueue &other) {
     before = after = 0;
     replaying = false;
     fermat = other.fermat;
+    session = other.session;
+    threads = other.threads;
     queue = other.queue;
+    product = other.product;
+    productCount = other.productCount;
+    pendingBytes = 0;
+    flushing = stopping = false;
+    binary = false;
+    journalPos = 0;
+    owner = NULL;
     _filename = "";
 }
 
@@ -38,11 +222,29 @@ TransformationQueue::TransformationQueue(Fermat *fermat) {
 	before = after = 0;
     replaying = false;
     this->fermat = fermat;
+    session = NULL;
+    threads = 1;
+    productCount = 0;
+    pendingBytes = 0;
+    flushing = stopping = false;
+    binary = false;
+    journalPos = 0;
+    owner = NULL;
     _filename = "";
 }
 
 TransformationQueue::~TransformationQueue() {
+    stopWriter();
 	if (file.is_open()) file.close();
+    if (index.is_open()) index.close();
+
+    if (_filename != "") {
+        try {
+            saveProduct(_filename);
+        } catch (const exception &e) {
+            cerr << "unable to save running product " << _filename << ".T: " << e.what() << endl;
+        }
+    }
 }
 
 void TransformationQueue::setpadding(int before, int after) {
@@ -52,35 +254,233 @@ void TransformationQueue::setpadding(int before, int after) {
 
 void TransformationQueue::setfile(string _filename, bool append) {
     if (_filename == "") return;
+
+    if (append && isJournal(_filename)) {
+        setjournal(_filename);
+        return;
+    }
     
+    stopWriter();
     if (file.is_open()) file.close();
+    if (index.is_open()) index.close();
 
     this->_filename = _filename;
+    binary = false;
 
     file.open(_filename,append?ios::app:ios::out);	
 
     if (!file.is_open()) {
         throw invalid_argument("unable to open file.");
     }
+
+    startWriter();
+}
+
+// opens a journal for appending. a torn record at the end is cut off and the index is rebuilt.
+void TransformationQueue::setjournal(string _filename) {
+    if (_filename == "") return;
+
+    stopWriter();
+    if (file.is_open()) file.close();
+    if (index.is_open()) index.close();
+
+    this->_filename = _filename;
+    binary = true;
+
+    vector<streamoff> offsets;
+    streamoff end = 0;
+
+    if (ifstream(_filename,ios::binary).peek() != EOF) {
+        offsets = journalRecords(_filename,true,end);
+
+        if (truncate(_filename.c_str(),end)) {
+            throw runtime_error("unable to truncate " + _filename + ".");
+        }
+    }
+
+    file.open(_filename,ios::binary|ios::app);
+    index.open(_filename+".idx",ios::binary|ios::out|ios::trunc);
+
+    if (!file.is_open() || !index.is_open()) {
+        throw invalid_argument("unable to open file.");
+    }
+
+    if (end == 0) {
+        file << journalMagic;
+        end = journalMagic.size();
+    }
+
+    for (auto pos : offsets) {
+        string buf;
+        put32(buf,pos&0xffffffff);
+        put32(buf,pos>>32);
+        index << buf;
+    }
+
+    journalPos = end;
+
+    startWriter();
+}
+
+void TransformationQueue::setSystem(System *system) {
+    owner = system;
+}
+
+void TransformationQueue::installSignalHandlers() {
+    signal(SIGUSR1,signalHandler);
+    signal(SIGINT,signalHandler);
+    signal(SIGTERM,signalHandler);
+}
+
+void TransformationQueue::startWriter() {
+    stopping = flushing = false;
+    activeWriters++;
+    writer = thread(&TransformationQueue::writerLoop,this);
+}
+
+void TransformationQueue::stopWriter() {
+    if (!writer.joinable()) return;
+
+    {
+        lock_guard<mutex> lock(mtx);
+        stopping = true;
+    }
+    cv.notify_all();
+
+    writer.join();
+    activeWriters--;
+}
+
+// blocks until everything recorded so far is written to the queue file.
+void TransformationQueue::flush() {
+    if (!writer.joinable()) return;
+
+    unique_lock<mutex> lock(mtx);
+    flushing = true;
+    cv.notify_all();
+    cv.wait(lock,[this]() { return !flushing; });
+}
+
+void TransformationQueue::enqueue(string line) {
+    if (!writer.joinable()) {
+        file << line;
+        return;
+    }
+
+    unique_lock<mutex> lock(mtx);
+    cv.wait(lock,[this]() { return pendingBytes < maxPending; });
+
+    pendingBytes += line.size();
+    pending.push_back(move(line));
+    cv.notify_all();
+}
+
+void TransformationQueue::writerLoop() {
+    unique_lock<mutex> lock(mtx);
+
+    for (;;) {
+        cv.wait_for(lock,chrono::milliseconds(200),[this]() { return !pending.empty() || flushing || stopping || queueSignal; });
+
+        while (!pending.empty()) {
+            string line = move(pending.front());
+            pending.pop_front();
+
+            lock.unlock();
+            if (binary) {
+                string buf;
+                put32(buf,journalPos&0xffffffff);
+                put32(buf,journalPos>>32);
+
+                file << line;
+                index << buf;
+                journalPos += line.size();
+            } else {
+                file << line;
+            }
+            lock.lock();
+
+            pendingBytes -= line.size();
+            cv.notify_all();
+        }
+
+        int sig = queueSignal;
+
+        if (flushing || stopping || sig) {
+            file.flush();
+            if (index.is_open()) index.flush();
+            flushing = false;
+            cv.notify_all();
+        }
+
+        if (sig == SIGUSR1) {
+            queueSignal = 0;
+        } else if (sig) {
+            signal(sig,SIG_DFL);
+            raise(sig);
+        }
+
+        if (stopping) break;
+    }
+}
+
+void TransformationQueue::setWorkers(Session *session, int threads) {
+    this->session = session;
+    this->threads = threads;
 }
 
 string TransformationQueue::filename() {
     return _filename;
 }
 
+bool TransformationQueue::isReplaying() const {
+    return replaying;
+}
+
 void TransformationQueue::load(string _filename) {
     ifstream file(_filename);
 	string str;
     
     Fermat *fermat = infinity.fer();
-    FermatExpression zero(fermat,"0");
 
     if (!file.is_open()) {
         throw invalid_argument("unable to open file.");
     }
-	
+
+    bool empty = queue.empty();
+
+    if (isJournal(_filename)) {
+        file.close();
+        loadJournal(_filename);
+        if (empty) loadProduct(_filename);
+        return;
+    }
+
+    bool framing = false;
+    vector<string> lines;
+
     while (getline(file,str)) {
+        lines.push_back(str);
+    }
+    file.close();
+
+    while (!lines.empty() && lines.back().find_first_not_of(" \t\r") == string::npos) {
+        lines.pop_back();
+    }
+	
+    for (size_t l=0; l<lines.size(); ++l) {
         transformation_t trans;
+        bool framed;
+
+        str = lines[l];
+
+        if (!unframe(str,framed) && (framed || framing)) {
+            if (l+1 == lines.size()) {
+                cout << "ignoring incomplete last entry of " << _filename << "." << endl;
+                break;
+            }
+            throw invalid_argument("corrupt entry in line " + to_string(l+1) + ".");
+        }
+        framing |= framed;
 
         str.erase(remove_if(str.begin(),str.end(),::isspace),str.end());
         if (str == "") continue;
@@ -90,68 +490,235 @@ void TransformationQueue::load(string _filename) {
             throw invalid_argument("parse error");
         }
         
-        string str0(str,0,colon);
-        str = str.erase(0,colon+1);
+        parseLabel(str.substr(0,colon),trans);
 
-        if (str0.substr(0,2) == "B(" && str0.back() == ')') {
-            size_t comma = str0.find(',');
-            if (comma == string::npos) {
-                throw invalid_argument("parse error");
-            }
-            
-            trans.type = transformation_t::Balance;
-            string xstr;
+        trans.T = FermatArray(fermat,str.substr(colon+1));
+        trans.parsed = true;
 
-            xstr = str0.substr(2,comma-2);
-            if (xstr == "inf") {
-                trans.x1 = infinity;
-            } else {
-                trans.x1 = FermatExpression(fermat,xstr);
-            }
+        queue.push_back(trans);
+    }
 
-            xstr = str0.substr(comma+1,str0.size()-comma-2);
-            if (xstr == "inf") {
-                trans.x2 = infinity;
-            } else {
-                trans.x2 = FermatExpression(fermat,xstr);
-            }
+    if (empty) loadProduct(_filename);
+}
 
-            trans.k = 0;
+// entries of a journal are loaded lazily, only their labels are read here.
+void TransformationQueue::loadJournal(string _filename) {
+    streamoff end;
+    vector<streamoff> offsets = journalRecords(_filename,false,end);
+    ifstream in(_filename,ios::binary);
+    string str;
 
-            trans.T = FermatArray(fermat,str);
-        } else if (str0 == "T") {
-            trans.type = transformation_t::Transformation;
-            trans.x1 = trans.x2 = zero;
-            trans.k = 0;
+    for (auto pos : offsets) {
+        transformation_t trans;
+        streamoff next;
 
-            trans.T = FermatArray(fermat,str);
-        } else if (str0.substr(0,2) == "L(" && str0.back() == ')') {
-            size_t comma = str0.find(',');
-            if (comma == string::npos) {
-                throw invalid_argument("parse error");
-            }
+        readRecord(in,pos,end,str,NULL,trans.state,next);
+        str.erase(remove_if(str.begin(),str.end(),::isspace),str.end());
 
-            trans.type = transformation_t::LeftTrans;
-            string xstr(str0,2,comma-2);
+        if (str.empty() || str.back() != ':') {
+            throw invalid_argument("parse error");
+        }
+        str.pop_back();
 
-            if (xstr == "inf") {
-                trans.x1 = infinity;
-            } else {
-                trans.x1 = FermatExpression(fermat,xstr);
-            }
-            
-            trans.k = stoi(str0.substr(comma+1,str0.size()-comma-2));
+        parseLabel(str,trans);
 
-            trans.x2 = zero;
+        trans.source = _filename;
+        trans.offset = pos;
+        trans.parsed = false;
+
+        queue.push_back(trans);
+    }
+}
+
+void TransformationQueue::fetch(const transformation_t &trans) const {
+    if (trans.parsed) return;
+
+    ifstream in(trans.source,ios::binary|ios::ate);
+    streamoff size = in.tellg();
+    string label, matrix;
+    uint32_t state;
+    streamoff end;
+
+    if (!readRecord(in,trans.offset,size,label,&matrix,state,end)) {
+        throw runtime_error("corrupt record in " + trans.source + ".");
+    }
+
+    trans.T = FermatArray(infinity.fer(),matrix);
+    trans.parsed = true;
+}
+
+void TransformationQueue::parseLabel(string str0, transformation_t &trans) const {
+    Fermat *fermat = infinity.fer();
+    FermatExpression zero(fermat,"0");
+
+    trans.before = trans.after = 0;
+    trans.state = 0;
+    trans.offset = 0;
+
+    if (!str0.empty() && str0.back() == ']') {
+        size_t bracket = str0.rfind('[');
+        size_t comma = str0.find(',',bracket);
+        if (bracket == string::npos || comma == string::npos) {
+            throw invalid_argument("parse error");
+        }
+
+        trans.before = stoi(str0.substr(bracket+1,comma-bracket-1));
+        trans.after = stoi(str0.substr(comma+1,str0.size()-comma-2));
+        str0.erase(bracket);
+    }
+
+    if (str0.substr(0,2) == "B(" && str0.back() == ')') {
+        size_t comma = str0.find(',');
+        if (comma == string::npos) {
+            throw invalid_argument("parse error");
+        }
+        
+        trans.type = transformation_t::Balance;
+        string xstr;
 
-            trans.T = FermatArray(fermat,str);
+        xstr = str0.substr(2,comma-2);
+        if (xstr == "inf") {
+            trans.x1 = infinity;
         } else {
-            throw invalid_argument("parse error.");
+            trans.x1 = FermatExpression(fermat,xstr);
         }
 
-        queue.push_back(trans);
+        xstr = str0.substr(comma+1,str0.size()-comma-2);
+        if (xstr == "inf") {
+            trans.x2 = infinity;
+        } else {
+            trans.x2 = FermatExpression(fermat,xstr);
+        }
+
+        trans.k = 0;
+    } else if (str0 == "T") {
+        trans.type = transformation_t::Transformation;
+        trans.x1 = trans.x2 = zero;
+        trans.k = 0;
+    } else if (str0.substr(0,2) == "L(" && str0.back() == ')') {
+        size_t comma = str0.find(',');
+        if (comma == string::npos) {
+            throw invalid_argument("parse error");
+        }
+
+        trans.type = transformation_t::LeftTrans;
+        string xstr(str0,2,comma-2);
+
+        if (xstr == "inf") {
+            trans.x1 = infinity;
+        } else {
+            trans.x1 = FermatExpression(fermat,xstr);
+        }
+        
+        trans.k = stoi(str0.substr(comma+1,str0.size()-comma-2));
+
+        trans.x2 = zero;
+    } else {
+        throw invalid_argument("parse error.");
+    }
+}
+
+void TransformationQueue::save(string _filename) const {
+    ofstream out(_filename);
+
+    if (!out.is_open()) {
+        throw invalid_argument("unable to open file.");
     }
+
+    for (auto &trans : queue) {
+        write(out,trans);
+    }
+
+    out.close();
+
+    saveProduct(_filename);
+}
+
+void TransformationQueue::loadProduct(string _filename) {
+    if (!queueProduct) return;
+
+    ifstream file(_filename + ".T");
+    string str;
+    size_t count;
+
+    if (!file.is_open()) return;
+    if (!(file >> count) || !getline(file >> ws,str)) return;
     file.close();
+
+    if (count != queue.size()) {
+        cout << "running product " << _filename << ".T is out of date." << endl;
+        return;
+    }
+
+    product = FermatArray(fermat,str);
+    productCount = count;
+}
+
+void TransformationQueue::saveProduct(string _filename) const {
+    if (!queueProduct || productCount == 0 || productCount != queue.size()) return;
+
+    ofstream out(_filename + ".T");
+
+    if (!out.is_open()) {
+        throw invalid_argument("unable to open file.");
+    }
+
+    out << productCount << endl;
+    out << product.str() << endl;
+    out.close();
+}
+
+/*
+ *  Merges adjacent entries of the same block: constant transformations are multiplied, balances between the
+ *  same points are added if their projectors annihilate each other. Then (1+f*P1)*(1+f*P2) = 1+f*(P1+P2), so
+ *  the merged queue is equivalent. Left transformations at the same point and order are always added: G maps
+ *  the columns of the A-block into the rows of the C-block, so the product of two of them vanishes.
+ */
+int TransformationQueue::compact(size_t first) {
+    size_t size = queue.size();
+
+    if (first >= size) return 0;
+
+    for (auto it = std::next(queue.begin(),first); it != queue.end();) {
+        auto next = std::next(it);
+
+        if (next == queue.end()) break;
+
+        if (merge(*it,*next)) {
+            queue.erase(next);
+        } else {
+            it = next;
+        }
+    }
+
+    if (productCount == size) productCount = queue.size();
+
+    return size-queue.size();
+}
+
+bool TransformationQueue::merge(transformation_t &a, const transformation_t &b) const {
+    if (a.type != b.type || a.before != b.before || a.after != b.after) return false;
+
+    fetch(a);
+    fetch(b);
+
+    switch (a.type) {
+        case transformation_t::Transformation:
+            a.T = a.T*b.T;
+            a.state = b.state;
+            return true;
+        case transformation_t::Balance:
+            if (!(a.x1 == b.x1) || !(a.x2 == b.x2)) return false;
+            if (!(a.T*b.T).isZero() || !(b.T*a.T).isZero()) return false;
+            break;
+        case transformation_t::LeftTrans:
+            if (!(a.x1 == b.x1) || a.k != b.k) return false;
+            break;
+    }
+
+    a.T = a.T+b.T;
+    a.state = b.state;
+    return true;
 }
 
 void TransformationQueue::replay(System &system) {
@@ -161,162 +728,366 @@ void TransformationQueue::replay(System &system) {
         throw invalid_argument("Replay not possible. Full system must be activated.");
     }
 
-    for (auto it = queue.begin(); it != queue.end(); ++it) {
+    // a journal stores the state after every entry: skip the entries the system has already seen.
+    auto start = queue.begin();
+    size_t first = 0;
+
+    if (any_of(queue.begin(),queue.end(),[](const transformation_t &t) { return t.state != 0; })) {
+        uint32_t current = state(system);
+        size_t n = 0;
+
+        for (auto it = queue.begin(); it != queue.end(); ++it) {
+            ++n;
+            if (it->state == current) {
+                start = std::next(it);
+                first = n;
+            }
+        }
+
+        if (first) cout << "system matches the state after entry " << first << ", resuming replay." << endl;
+    }
+
+    int merged = compact(first);
+    if (merged) cout << "merged " << merged << " queue entries." << endl;
+
+    for (auto it = start; it != queue.end(); ++it) {
         switch (it->type) {
             case transformation_t::Balance:
                 cout << "balance [" << pstr(it->x1) << "," << pstr(it->x2) << "]" << endl;
-                system.balance(it->T,it->x1,it->x2);
+                system.balance(expand(*it),it->x1,it->x2);
                 break;
             case transformation_t::Transformation:
                 cout << "transformation" << endl;
-                system.transform(it->T);
+                system.transform(expand(*it));
                 break;
             case transformation_t::LeftTrans:
                 cout << "left transformation [" << pstr(it->x1) << "," << it->k << "]" << endl;
 
-                system.lefttransformFull(it->T,it->x1,it->k);
+                system.lefttransformFull(expand(*it),it->x1,it->k);
                 break;
         }
+
+        if (it->state != 0 && state(system) != it->state) {
+            cout << "warning: state of the system does not match the journal." << endl;
+        }
     }
 
     replaying = false;
 }
 
+FermatArray TransformationQueue::xmatrix(const transformation_t &trans) const {
+    FermatArray T = expand(trans);
+    Fermat *fermat = T.fer();
+    FermatExpression one(fermat,"1");
+    FermatArray xT(fermat);
+    stringstream strm;
+
+    switch(trans.type) {
+        case transformation_t::Balance:
+            if (trans.x1 == infinity) {
+                strm << "[" << T.name() << "]*(x-(" << (trans.x2+one).str() << ")) + [1]";
+            } else if (trans.x2 == infinity) {
+                strm << "[" << T.name() << "]*((" << (trans.x1+one).str() << ")-x)/(x-(" << trans.x1.str() << ")) + [1]"; 
+            } else {
+                strm << "[" << T.name() << "]*(" << (trans.x1-trans.x2).str() << ")/(x-(" << trans.x1.str() << ")) + [1]";
+            }
+            xT.assign(strm.str());
+            break;
+        case transformation_t::Transformation:
+            xT = T;
+            break;
+        case transformation_t::LeftTrans:
+            if (trans.x1 == infinity) {
+                strm << "[" << T.name() << "]*x^(" << trans.k << ") + [1]";
+            } else {
+                strm << "[" << T.name() << "]/(x-(" << trans.x1.str() << "))^(" << trans.k << ") + [1]";
+            }
+            xT.assign(strm.str());
+            break;
+    }
+
+    return xT;
+}
+
+void TransformationQueue::accumulate() {
+    if (!queueProduct || productCount+1 != queue.size()) return;
+
+    if (productCount == 0) {
+        product = xmatrix(queue.back());
+    } else {
+        product = product*xmatrix(queue.back());
+    }
+
+    productCount++;
+}
+
 void TransformationQueue::exporttrans(string filename) {
     if (!queue.size()) {
         throw invalid_argument("transformation queue is empty.");
     }
 
-    Fermat *fermat = queue.begin()->T.fer();
-    FermatExpression one(fermat,"1");
-    int size = queue.begin()->T.rows();
-    FermatArray T(fermat,size,size);
-    T.assign("[1] + 0");
+    if (queueProduct && productCount == queue.size()) {
+        ofstream file(filename);
+        file << product.str() << endl;
+        file.close();
+        return;
+    }
+
+    Fermat *fermat = infinity.fer();
+    vector<FermatArray> factors;
     
-    fermat->addSymbol("x");
+    // x goes through the session, worker sessions need it as well
+    auto symbol = [&](bool add) {
+        if (queueProduct) return;
 
-    for (auto it = queue.begin(); it != queue.end(); ++it) {
-        stringstream strm;
-        FermatArray xT(fermat);
+        if (session) {
+            if (add) session->addSymbol(fermat,"x");
+            else session->dropSymbol(fermat,"x");
+        } else {
+            if (add) fermat->addSymbol("x");
+            else fermat->dropSymbol("x");
+        }
+    };
 
-        switch(it->type) {
-            case transformation_t::Balance:
-                cout << "balance (" << pstr(it->x1) << "," << pstr(it->x2) << ")" << endl;
-                if (it->x1 == infinity) {
-                    strm << "[" << it->T.name() << "]*(x-(" << (it->x2+one).str() << ")) + [1]";
-                } else if (it->x2 == infinity) {
-                    strm << "[" << it->T.name() << "]*((" << (it->x1+one).str() << ")-x)/(x-(" << it->x1.str() << ")) + [1]"; 
-                } else {
-                    strm << "[" << it->T.name() << "]*(" << (it->x1-it->x2).str() << ")/(x-(" << it->x1.str() << ")) + [1]";
-                }
-                xT.assign(strm.str());
-                break;
-            case transformation_t::Transformation:
-                cout << "transformation" << endl;
-                xT = it->T;
-                break;
-            case transformation_t::LeftTrans:
-                cout << "left transformation(" << pstr(it->x1) << "," << it->k << ")" << endl;
-                if (it->x1 == infinity) {
-                    strm << "[" << it->T.name() << "]*x^(" << it->k << ") + [1]";
-                } else {
-                    strm << "[" << it->T.name() << "]/(x-(" << it->x1.str() << "))^(" << it->k << ") + [1]";
-                }
-                xT.assign(strm.str());
-                break;
+    symbol(true);
+
+    try {
+        for (auto it = queue.begin(); it != queue.end(); ++it) {
+            switch(it->type) {
+                case transformation_t::Balance:
+                    cout << "balance (" << pstr(it->x1) << "," << pstr(it->x2) << ")" << endl;
+                    break;
+                case transformation_t::Transformation:
+                    cout << "transformation" << endl;
+                    break;
+                case transformation_t::LeftTrans:
+                    cout << "left transformation(" << pstr(it->x1) << "," << it->k << ")" << endl;
+                    break;
+            }
+
+            factors.push_back(xmatrix(*it));
+        }
+
+        string T;
+        bool parallel = false;
+
+        if (session && threads > 1 && factors.size() > 2) {
+            vector<string> strs;
+
+            for (auto &f : factors) {
+                strs.push_back(f.str());
+            }
+
+            parallel = productTreeParallel(strs,T);
+
+            if (!parallel) {
+                cout << "WARNING: product of transformations failed in worker session. continuing serially." << endl;
+            }
         }
 
-        T = T*xT;
+        if (!parallel) {
+            T = productTree(factors);
+        }
+
+        ofstream file(filename);
+        file << T << endl;
+        file.close();
+    } catch (...) {
+        symbol(false);
+        throw;
     }
 
-    ofstream file(filename);
-    file << T.str() << endl;
-    file.close();
+    symbol(false);
+}
+
+/*
+ *  The factors are multiplied pairwise, level by level, such that both operands of every product
+ *  cover the same number of queue entries.
+ */
+string TransformationQueue::productTree(vector<FermatArray> &factors) const {
+    while (factors.size() > 1) {
+        vector<FermatArray> next;
+
+        for (size_t i=0; i+1<factors.size(); i+=2) {
+            next.push_back(factors[i]*factors[i+1]);
+        }
+
+        if (factors.size()%2) next.push_back(factors.back());
+
+        factors.swap(next);
+    }
 
-    fermat->dropSymbol("x");
+    return factors.front().str();
 }
 
-void TransformationQueue::balance(const FermatArray &P, const FermatExpression &x1, const FermatExpression &x2) {
-    if (replaying) return;
+/*
+ *  Same as productTree, but the products of a level are independent and computed concurrently in worker
+ *  sessions. Workers only see strings, the last product is never parsed by the main session.
+ */
+bool TransformationQueue::productTreeParallel(vector<string> factors, string &T) const {
+    WorkerPool &pool = session->workers();
 
-    Fermat *fermat = P.fer();
-    FermatArray xP(fermat,P.rows()+before+after,P.cols()+before+after);
-    stringstream strm;
+    cout << "multiplying " << factors.size() << " factors in " << min((size_t)threads,factors.size()/2) << " sessions." << endl;
 
-    xP.assign("0");
-    
-    strm << "[" << xP.name() << "[" << before+1 << "~" << before+P.rows() << "," << before+1 << "~" << before+P.cols() << "]] := [" << P.name() << "]";
-    (*fermat)(strm.str());
+    while (factors.size() > 1) {
+        size_t n = factors.size()/2;
+        vector<string> next(n);
+
+        bool ok = pool.run(threads,n,[&](Fermat *worker, size_t i, size_t) {
+            FermatArray A(worker,factors[2*i]);
+            FermatArray B(worker,factors[2*i+1]);
+
+            next[i] = (A*B).str();
+        });
 
-    if (file.is_open()) {
-        file << "B(" << pstr(x1) << "," << pstr(x2) << "):  \t" << xP.str() << endl; 
+        if (!ok) return false;
+
+        if (factors.size()%2) next.push_back(move(factors.back()));
+
+        factors.swap(next);
     }
 
+    T = factors.front();
+    return true;
+}
+
+void TransformationQueue::balance(const FermatArray &P, const FermatExpression &x1, const FermatExpression &x2) {
+    if (replaying) return;
+
     transformation_t trans;
 
     trans.type = transformation_t::Balance;
     trans.x1 = x1;
     trans.x2 = x2;
     trans.k = 0;
-    trans.T = xP;
+    trans.T = FermatArray(P);
 
-    queue.push_back(trans);
+    record(trans);
 }
 
 void TransformationQueue::transform(const FermatArray &T) {
     if (replaying) return;
 
-    Fermat *fermat = infinity.fer();
-    FermatExpression zero(fermat,"0");
-    FermatArray xT(fermat,T.rows()+before+after,T.cols()+before+after);
-    stringstream strm;
-
-    xT.assign("[1] + 0");
-    
-    strm << "[" << xT.name() << "[" << before+1 << "~" << before+T.rows() << "," << before+1 << "~" << before+T.cols() << "]] := [" << T.name() << "]";
-    (*fermat)(strm.str());
-
-    if (file.is_open()) {
-        file << "T:        \t" << xT.str() << endl; 
-    }
-
+    FermatExpression zero(T.fer(),"0");
     transformation_t trans;
 
     trans.type = transformation_t::Transformation;
     trans.x1 = zero;
     trans.x2 = zero;
     trans.k = 0;
-    trans.T = xT;
+    trans.T = FermatArray(T);
 
-    queue.push_back(trans);
+    record(trans);
 }
     
 void TransformationQueue::lefttransform(const FermatArray &G, const FermatExpression &x1, int k) {
     if (replaying) return;
 
-    Fermat *fermat = G.fer();
-    FermatExpression zero(fermat,"0");
-    FermatArray xG(fermat,G.rows()+before+after,G.rows()+before+after);
-    stringstream strm;
-
-    xG.assign("0");
-
-    strm << "[" << xG.name() << "[" << before+1 << "~" << before+G.rows() << ",1~" << G.cols() << "]] := [" << G.name() << "]";
-    (*fermat)(strm.str());
-
-    if (file.is_open()) {
-        file << "L(" << pstr(x1) << "," << k << "):  \t" << xG.str() << endl;
-    }
-
+    FermatExpression zero(G.fer(),"0");
     transformation_t trans;
 
     trans.type = transformation_t::LeftTrans;
     trans.x1 = x1;
     trans.x2 = zero;
     trans.k = k;
-    trans.T = xG;
+    trans.T = FermatArray(G);
+
+    record(trans);
+}
+
+void TransformationQueue::record(transformation_t &trans) {
+    trans.before = before;
+    trans.after = after;
+    trans.state = 0;
+    trans.offset = 0;
+    trans.parsed = true;
+
+    if (file.is_open() && binary) {
+        if (owner && before == 0 && after == 0) trans.state = state(*owner);
+        enqueue(journalRecord(trans));
+    } else if (file.is_open()) {
+        stringstream strm;
+        write(strm,trans);
+        enqueue(strm.str());
+    }
 
     queue.push_back(trans);
+    accumulate();
+}
+
+string TransformationQueue::label(const transformation_t &trans) const {
+    stringstream strm;
+
+    switch (trans.type) {
+        case transformation_t::Balance:
+            strm << "B(" << pstr(trans.x1) << "," << pstr(trans.x2) << ")";
+            break;
+        case transformation_t::Transformation:
+            strm << "T";
+            break;
+        case transformation_t::LeftTrans:
+            strm << "L(" << pstr(trans.x1) << "," << trans.k << ")";
+            break;
+    }
+
+    strm << "[" << trans.before << "," << trans.after << "]:";
+
+    return strm.str();
+}
+
+void TransformationQueue::write(ostream &out, const transformation_t &trans) const {
+    string str = label(trans);
+
+    fetch(trans);
+
+    str += string(max(0,10-(int)str.size()),' ') + "\t" + trans.T.str();
+
+    out << frame(str) << "\n";
+}
+
+string TransformationQueue::journalRecord(const transformation_t &trans) const {
+    string str0 = label(trans);
+    string str = trans.T.str();
+    string st, rec;
+
+    put32(st,trans.state);
+
+    put32(rec,recordMagic);
+    put32(rec,str0.size());
+    put32(rec,str.size());
+    rec += str0 + str + st;
+    put32(rec,crc32(str0 + str + st));
+
+    return rec;
+}
+
+// a nonzero checksum of the residues of the system.
+uint32_t TransformationQueue::state(const System &system) const {
+    uint32_t crc = crc32(system.fingerprint());
+    return crc ? crc : 1;
+}
+
+/*
+ *  Pads a block local matrix to the full system: zeros around balances and left transformations, unity around
+ *  transformations. Left transformations couple to the preceding blocks, their columns start at 1.
+ */
+FermatArray TransformationQueue::expand(const transformation_t &trans) const {
+    fetch(trans);
+
+    if (trans.before == 0 && trans.after == 0) return trans.T;
+
+    Fermat *fermat = trans.T.fer();
+    int size = trans.T.rows()+trans.before+trans.after;
+    int c1 = trans.type == transformation_t::LeftTrans ? 1 : trans.before+1;
+    FermatArray xT(fermat,size,size);
+    stringstream strm;
+
+    xT.assign(trans.type == transformation_t::Transformation ? "[1] + 0" : "0");
+
+    strm << "[" << xT.name() << "[" << trans.before+1 << "~" << trans.before+trans.T.rows() << "," << c1 << "~" << c1+trans.T.cols()-1 << "]] := [" << trans.T.name() << "]";
+    (*fermat)(strm.str());
+
+    return xT;
 }
 
 string TransformationQueue::pstr(const FermatExpression &x) const {
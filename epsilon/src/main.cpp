@@ -21,28 +21,35 @@
 
 #include <System.h>
 #include <Dyson.h>
+#include <Session.h>
 #include <FermatArray.h>
 #include <ctime>
 #include <iostream>
 #include <iomanip>
 #include <string>
 #include <algorithm>
+#include <cstdlib>
+#include <unistd.h>
 using namespace std;
 
-#include "functions_fer.h"
+static const char *infinityValue = "115792089237316195423570985008687907853269984665640564039457584007913129639935";
 
 typedef struct {
     enum {
         Fermat,
         Load,
         Queue,
+        Journal,
         LoadQueue,
+        Monitor,
         Replay,
+        CompactQueue,
         Export,
         Write,
         Block,
         Fuchsify,
         Normalize,
+        Simplify,
         FactorEp,
         FactorEpAt,
         LeftRanks,
@@ -81,7 +88,7 @@ static inline string &trim(string &s) {
     return ltrim(rtrim(s));
 }
 
-static void executeFermat(Fermat *fermat, const string &filename) {
+static void executeFermat(Session *session, Fermat *fermat, const string &filename) {
     ifstream file(filename);
 
     if (!file.is_open()) {
@@ -98,45 +105,82 @@ static void executeFermat(Fermat *fermat, const string &filename) {
         trim(line);
         if (line == "") continue;
 
-        (*fermat)(line);
+        session->execute(fermat,line);
     }
 
     file.close();
 }
 
-static void sourceFermatFunctions(Fermat *fermat) {
-    bool first=true;
-    string tmpdir = getenv("TMPDIR")?getenv("TMPDIR"):"/tmp";
-    tmpdir += "/epsilonXXXXXX";
+/*
+ *  activates the polymod whose symbol occurs most often in the active block. The system and its transformation
+ *  queue are written out and read back into a new fermat session with the matching symbol order.
+ */
+static System *selectPolymod(Session *session, Fermat *&fermat, System *system, int start, int end, SizeMonitor *monitor, const SystemOptions &options) {
+    map<string,int> counts = system->countSymbols(session->polymods());
+    vector<string> used;
 
-    mkdtemp(&tmpdir[0]);
+    // only one polymod can be active, any other algebraic number would be treated as transcendental
+    for (auto &c : counts) {
+        if (c.second > 0) used.push_back(c.first);
+    }
 
-    ofstream file(tmpdir+"/functions.fer");
-    if (!file.is_open()) {
-        throw invalid_argument("unable to open "+tmpdir+"/functions.fer");
+    if (used.size() > 1) {
+        throw invalid_argument("active block depends on the polymods " + used[0] + " and " + used[1] + ". only one polymod can be active.");
     }
 
-    for (auto line : _functions_fer) {
-        rtrim(line);
-        if (line == "") continue;
+    string best = session->polymod();
+    int bestcount = best == "" ? 0 : counts[best];
+
+    for (auto &c : counts) {
+        if (c.second > bestcount) {
+            best = c.first;
+            bestcount = c.second;
+        }
+    }
+
+    if (best == session->polymod()) return system;
+
+    string tmpdir = getenv("TMPDIR")?getenv("TMPDIR"):"/tmp";
+    tmpdir += "/epsilonXXXXXX";
 
-        if (!first) file << endl;
-        file << line;
-        first=false;
+    if (!mkdtemp(&tmpdir[0])) {
+        throw runtime_error("unable to create temporary directory.");
     }
 
-    file.close();
+    string queuefile = system->transformationQueue()->filename();
+
+    system->write(tmpdir+"/system");
+    system->transformationQueue()->save(tmpdir+"/queue");
+    delete system;
 
-    (*fermat)("&(U=0)");
-    (*fermat)("&(R=\'"+tmpdir+"/functions.fer\')"); 
-    (*fermat)("&(U=1)");
+    session->setPolymod(best);
+    Fermat *newfermat = session->create();
 
-    unlink((tmpdir+"/functions.fer").c_str());
+    infinity = FermatExpression(newfermat,infinityValue);
+    delete fermat;
+    fermat = newfermat;
+
+    system = new System(fermat, tmpdir+"/system", start, end, options);
+    system->transformationQueue()->load(tmpdir+"/queue");
+    system->transformationQueue()->setfile(queuefile,true);
+    system->setMonitor(monitor);
+    system->setSession(session);
+
+    unlink((tmpdir+"/system").c_str());
+    unlink((tmpdir+"/queue").c_str());
+    unlink((tmpdir+"/queue.T").c_str());
     rmdir(tmpdir.c_str());
+
+    cout << "switched to polymod " << best << "." << endl;
+
+    return system;
 }
 
-static void handleJobs(Fermat *fermat, const vector<Job> &jobs, bool timings, bool echfer) {
-    System *system = new System(fermat,echfer);
+static void handleJobs(Session *session, Fermat *&fermat, const vector<Job> &jobs, bool timings, const SystemOptions &options) {
+    System *system = new System(fermat,options);
+    SizeMonitor *monitor = NULL;
+
+    system->setSession(session);
 
     for (auto it = jobs.begin(); it != jobs.end(); ++it) {
         struct timespec start,end;
@@ -148,18 +192,34 @@ static void handleJobs(Fermat *fermat, const vector<Job> &jobs, bool timings, bo
         switch(it->type) {
             case Job::Fermat:
                 cout << "sourcing " << it->filename << endl;
-                executeFermat(fermat,it->filename);
+                executeFermat(session,fermat,it->filename);
                 break;
             case Job::Load:
                 if (system) delete system;
-                system = new System(fermat, it->filename, it->start, it->end, echfer);
+                system = new System(fermat, it->filename, it->start, it->end, options);
+                system->setMonitor(monitor);
+                system->setSession(session);
                 cout << "loaded system from " << it->filename << "." << endl;
                 cout << "active block is [" << it->start << "," << it->end << "]." << endl;
+
+                if (!session->polymods().empty()) {
+                    system = selectPolymod(session,fermat,system,it->start,it->end,monitor,options);
+                }
                 break;
             case Job::Queue:
                 system->transformationQueue()->setfile(it->filename,it->append);
                 cout << "set transformation queue to " << it->filename << (it->append?" (append mode).":" (overwrite mode).") << endl;
                 break;
+            case Job::Journal:
+                system->transformationQueue()->setjournal(it->filename);
+                cout << "set transformation journal to " << it->filename << "." << endl;
+                break;
+            case Job::Monitor:
+                if (monitor) delete monitor;
+                monitor = new SizeMonitor(it->filename);
+                system->setMonitor(monitor);
+                cout << "monitoring expression sizes in " << it->filename << "." << endl;
+                break;
             case Job::LoadQueue:
                 system->transformationQueue()->load(it->filename);
                 cout << "loaded queue from " << it->filename << "." << endl;
@@ -169,6 +229,12 @@ static void handleJobs(Fermat *fermat, const vector<Job> &jobs, bool timings, bo
                 system->transformationQueue()->replay(*system);
                 cout << endl;
                 break;
+            case Job::CompactQueue: {
+                int merged = system->transformationQueue()->compact();
+                system->transformationQueue()->save(it->filename);
+                cout << "merged " << merged << " queue entries, compacted queue written to " << it->filename << "." << endl;
+                break;
+            }
             case Job::Export:
                 cout << endl << "export" << endl << "------" << endl;
                 system->transformationQueue()->exporttrans(it->filename);
@@ -186,8 +252,14 @@ static void handleJobs(Fermat *fermat, const vector<Job> &jobs, bool timings, bo
                 delete oldsystem;
 
                 system->transformationQueue()->setfile(filename,true);
+                system->setMonitor(monitor);
+                system->setSession(session);
                 
                 cout << "block [" << it->start << "," << it->end << "] activated." << endl;
+
+                if (!session->polymods().empty()) {
+                    system = selectPolymod(session,fermat,system,it->start,it->end,monitor,options);
+                }
                 break;
             }
             case Job::Fuchsify:
@@ -200,6 +272,11 @@ static void handleJobs(Fermat *fermat, const vector<Job> &jobs, bool timings, bo
                 system->normalize();
                 cout << endl;
                 break;
+            case Job::Simplify:
+                cout << endl << "simplify" << endl << "--------" << endl;
+                system->simplify();
+                cout << endl;
+                break;
             case Job::FactorEp:
                 cout << endl << "factor ep" << endl << "---------" << endl;
                 system->factorep();
@@ -245,6 +322,8 @@ static void handleJobs(Fermat *fermat, const vector<Job> &jobs, bool timings, bo
             }
         }
 
+        if (system) system->transformationQueue()->flush();
+
         if (timings) {
             timespec diff;
             clock_gettime(CLOCK_MONOTONIC_COARSE,&end);
@@ -262,6 +341,7 @@ static void handleJobs(Fermat *fermat, const vector<Job> &jobs, bool timings, bo
     }
 
     if (system) delete system;
+    if (monitor) delete monitor;
 }
 
 static vector<string> parseSymbols(const string &str) {
@@ -289,7 +369,16 @@ static void usage(string progname) {
     cerr << setw(60) << "   --verbose"                                               << "Enable verbose output." << endl;
     cerr << setw(60) << "   --timings"                                               << "Enable timings." << endl;
     cerr << setw(60) << "   --symbols <symbols>"                                     << "Add symbols to fermat. <symbols> should be a comma separated list." << endl;
+    cerr << setw(60) << "   --polymod <symbol> <polynomial>"                         << "Register a polymod. The one needed by the active block is set automatically." << endl;
     cerr << setw(60) << "   --echelon-fermat"                                        << "Use fermat's Redrowech function to solve LSEs." << endl;
+    cerr << setw(60) << "   --echelon-auto"                                          << "Choose between the sparse solver and fermat's Redrowech for every LSE." << endl;
+    cerr << setw(60) << "   --echelon-spill <n>"                                     << "Keep at most <n> rows of the sparse LSE solver in memory, spill the rest to disk." << endl;
+    cerr << setw(60) << "   --markowitz"                                             << "Choose pivots of LSEs by the Markowitz criterion to reduce fill-in." << endl;
+    cerr << setw(60) << "   --modular"                                               << "Solve --factorep modulo primes and reconstruct rationally, symbolic solve as fallback." << endl;
+    cerr << setw(60) << "   --threads <n>"                                           << "Use <n> fermat sessions for independent computations." << endl;
+    cerr << setw(60) << "   --gram-schmidt"                                          << "Complete Jordan bases by Gram-Schmidt orthogonalization (legacy)." << endl;
+    cerr << setw(60) << "   --queue-product"                                         << "Keep the exported transformation up to date while transformations are queued." << endl;
+    cerr << setw(60) << "   --simplify-every <n>"                                    << "Run --simplify after every <n> transformations." << endl;
     cerr << endl;
 
     cerr << "JOBS:" << endl;
@@ -298,12 +387,16 @@ static void usage(string progname) {
     cerr << setw(60) << "   --write <filename>"                                      << "Write system to <filename>." << endl;
     cerr << setw(60) << "   --queue <filename>"                                      << "Use <filename> as transformation queue (overwrite mode)." << endl;
     cerr << setw(60) << "   --queue-append <filename>"                               << "Use <filename> as transformation queue (append mode)." << endl;
+    cerr << setw(60) << "   --journal <filename>"                                    << "Append transformations to the binary journal <filename>, replay resumes from it." << endl;
     cerr << setw(60) << "   --load-queue <filename>"                                 << "Load transformation queue from <filename>." << endl;
+    cerr << setw(60) << "   --monitor <filename>"                                    << "Write expression sizes after every transformation to <filename>." << endl;
     cerr << setw(60) << "   --replay"                                                << "Replay transformation queue." << endl; 
+    cerr << setw(60) << "   --compact-queue <filename>"                              << "Merge composable entries of the transformation queue and write it to <filename>." << endl;
     cerr << setw(60) << "   --export <filename>"                                     << "Export transformation matrix as Mathematica(R) file <filename>." << endl;
     cerr << setw(60) << "   --block <start> <end>"                                   << "Activate block from <start> to <end>." << endl;
     cerr << setw(60) << "   --fuchsify"                                              << "Put system into fuchsian form. [arXiv:1411.0911, Algorithm 2]" << endl;
     cerr << setw(60) << "   --normalize"                                             << "Normalize eigenvalues. [arXiv:1411.0911, Algorithm 3]" << endl;
+    cerr << setw(60) << "   --simplify"                                              << "Divide out row or column contents of the active block if this shrinks the system." << endl;
     cerr << setw(60) << "   --factorep"                                              << "Put system into ep-form. Autodetect mu. [arXiv:1411.0911, Section 6]" << endl;
     cerr << setw(60) << "   --factorep-at <mu>"                                      << "Put system into ep-form. Use mu=<mu>." << endl;
     cerr << setw(60) << "   --left-fuchsify"                                         << "Put block to the left of active block in fuchsian form (automatic approach). [arXiv:1411.0911, Section 7]" << endl;
@@ -319,11 +412,20 @@ static void usage(string progname) {
 static int cmdline(string progname, vector<string> parameters) {
     string fermatpath="fer64";
     vector<string> symbols;
+    vector<pair<string,string>> polymods;
     bool verbose = false;
     bool timings = false;
-    bool echfer = false;
+    SystemOptions options;
     vector<Job> jobs;
 
+    options.echfer = false;
+    options.echauto = false;
+    options.markowitz = false;
+    options.modular = false;
+    options.spill = 0;
+    options.simplify = 0;
+    options.threads = 1;
+
     if (parameters.empty()) usage(progname);
     
     if (getenv("FERMAT")) {
@@ -343,10 +445,37 @@ static int cmdline(string progname, vector<string> parameters) {
         } else if (*it == "--timings") {
             timings = true;
         } else if (*it == "--echelon-fermat") {
-            echfer = true;
+            options.echfer = true;
+        } else if (*it == "--echelon-auto") {
+            options.echauto = true;
+        } else if (*it == "--echelon-spill") {
+            if (++it == parameters.end()) usage(progname);
+            options.spill = atoi(it->c_str());
+        } else if (*it == "--markowitz") {
+            options.markowitz = true;
+        } else if (*it == "--modular") {
+            options.modular = true;
+        } else if (*it == "--threads") {
+            if (++it == parameters.end()) usage(progname);
+            options.threads = atoi(it->c_str());
+        } else if (*it == "--gram-schmidt") {
+            jordanGramSchmidt = true;
+        } else if (*it == "--queue-product") {
+            queueProduct = true;
+        } else if (*it == "--simplify-every") {
+            if (++it == parameters.end()) usage(progname);
+            options.simplify = atoi(it->c_str());
         } else if (*it == "--symbols") {
             if (++it == parameters.end()) usage(progname);
             symbols = parseSymbols(*it);
+        } else if (*it == "--polymod") {
+            string symbol;
+
+            if (++it == parameters.end()) usage(progname);
+            symbol = *it;
+
+            if (++it == parameters.end()) usage(progname);
+            polymods.push_back({symbol,*it});
         } else if (*it == "--fermat") {
             job.type = Job::Fermat;
 
@@ -388,6 +517,13 @@ static int cmdline(string progname, vector<string> parameters) {
             if (++it == parameters.end()) usage(progname);
             job.filename = *it;
 
+            jobs.push_back(job);
+        } else if (*it == "--journal") {
+            job.type = Job::Journal;
+            
+            if (++it == parameters.end()) usage(progname);
+            job.filename = *it;
+
             jobs.push_back(job);
         } else if (*it == "--load-queue") {
             job.type = Job::LoadQueue;
@@ -395,10 +531,24 @@ static int cmdline(string progname, vector<string> parameters) {
             if (++it == parameters.end()) usage(progname);
             job.filename = *it;
 
+            jobs.push_back(job);
+        } else if (*it == "--monitor") {
+            job.type = Job::Monitor;
+            
+            if (++it == parameters.end()) usage(progname);
+            job.filename = *it;
+
             jobs.push_back(job);
         } else if (*it == "--replay") {
             job.type = Job::Replay;
 
+            jobs.push_back(job);
+        } else if (*it == "--compact-queue") {
+            job.type = Job::CompactQueue;
+
+            if (++it == parameters.end()) usage(progname);
+            job.filename = *it;
+
             jobs.push_back(job);
         } else if (*it == "--export") {
             job.type = Job::Export;
@@ -424,6 +574,10 @@ static int cmdline(string progname, vector<string> parameters) {
         } else if (*it == "--normalize") {
             job.type = Job::Normalize;
 
+            jobs.push_back(job);
+        } else if (*it == "--simplify") {
+            job.type = Job::Simplify;
+
             jobs.push_back(job);
         } else if (*it == "--factorep") {
             job.type = Job::FactorEp;
@@ -493,18 +647,30 @@ static int cmdline(string progname, vector<string> parameters) {
     }
 
 
-    Fermat fermat(fermatpath,verbose);
-    fermat("&(_o=0)");
+    Session session(fermatpath,verbose);
+    Fermat *fermat = session.create();
+    session.execute(fermat,"&(_o=0)");
   
+    for (auto &pm : polymods) {
+        session.addPolymod(pm.first,pm.second);
+
+        if (find(symbols.begin(),symbols.end(),pm.first) == symbols.end()) {
+            symbols.push_back(pm.first);
+        }
+    }
+
     for (auto &s : symbols) {
-        fermat.addSymbol(s);
+        session.addSymbol(fermat,s);
     }
 
-    fermat.addSymbol("ep");
-    fermat.addSymbol("t");
-    sourceFermatFunctions(&fermat);
+    session.addSymbol(fermat,"ep");
+    session.addSymbol(fermat,"t");
+    if (queueProduct) session.addSymbol(fermat,"x");
+    session.sourceFunctions(fermat);
+
+    infinity = FermatExpression(fermat,infinityValue);
 
-    infinity = FermatExpression(&fermat,"115792089237316195423570985008687907853269984665640564039457584007913129639935");
+    TransformationQueue::installSignalHandlers();
 
     struct timespec start,end;
 
@@ -512,7 +678,7 @@ static int cmdline(string progname, vector<string> parameters) {
         clock_gettime(CLOCK_MONOTONIC_COARSE,&start);
     }
 
-    handleJobs(&fermat, jobs, timings, echfer);
+    handleJobs(&session, fermat, jobs, timings, options);
 
     if (timings) {
         timespec diff;
@@ -531,6 +697,8 @@ static int cmdline(string progname, vector<string> parameters) {
 
     infinity = FermatExpression();
 
+    delete fermat;
+
     return 0;
 }
 